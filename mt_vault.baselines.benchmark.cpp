@@ -0,0 +1,138 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <random>
+
+#include "mt_vault.baselines.h"
+#include "mt_vault.benchmark.h"
+#include "mt_vault.harness.h"
+#include "mt_vault.perf.h"
+#include "my_vault.h"
+
+// Vault against the alternatives of mt_vault.baselines.h, every workload run on every implementation with the same
+// capacity, thread counts and random sequences:
+//   allocate  fill an empty container from all workers
+//   view      random views of a full container, touching the payload
+//   mixed     62% view, 12% allocate, 25% deallocate by index, 1% deallocate by predicate, about half full
+//   scan      deallocate(pred) with a predicate that never matches, on a full container
+
+constexpr size_t baselineSlots = 1024 * 16;
+
+template<class ElementData, size_t COUNT>
+using ShardedMap = ShardedMapVault<ElementData, COUNT>;
+
+template<class V>
+void baseline_fill (V& v, ThreadPool& pool, size_t count)
+{
+    pool.run([&v, &pool, count] (size_t w) {
+        for ( size_t n = w; n < count; n += pool.size( ) )
+            if ( auto [view, inserted] = v.allocate( ); inserted )
+                view( ).field_3.assign(fmt::format("{}_{}", w, n));
+    });
+}
+
+template<template<class, size_t> class V>
+void baseline_allocate (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    using Container = V<Data, baselineSlots>;
+    ThreadPool                 pool {static_cast<size_t>(state.range(0))};
+    std::unique_ptr<Container> v;
+    perf.start( );
+    for ( auto _: state ) {
+        perf.pause( );
+        v = std::make_unique<Container>( );
+        perf.resume( );
+        baseline_fill(*v, pool, baselineSlots);
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * baselineSlots));
+}
+
+template<template<class, size_t> class V>
+void baseline_view (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t views = 4096;
+    ThreadPool       pool {static_cast<size_t>(state.range(0))};
+    auto             v = std::make_unique<V<Data, baselineSlots>>( );
+    baseline_fill(*v, pool, baselineSlots);
+    perf.start( );
+    for ( auto _: state ) {
+        pool.run([&v] (size_t w) {
+            std::mt19937_64 rng {w};
+            for ( size_t n = 0; n < views; n++ )
+                if ( auto view = v->view(rng( ) % baselineSlots) )
+                    view( ).field_1++;
+        });
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * views * pool.size( )));
+}
+
+template<template<class, size_t> class V>
+void baseline_mixed (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t ops = 4096;
+    ThreadPool       pool {static_cast<size_t>(state.range(0))};
+    auto             v = std::make_unique<V<Data, baselineSlots>>( );
+    baseline_fill(*v, pool, baselineSlots / 2);
+    perf.start( );
+    for ( auto _: state ) {
+        pool.run([&v] (size_t w) {
+            std::mt19937_64 rng {w};
+            for ( size_t n = 0; n < ops; n++ ) {
+                const auto dice = rng( ) % 100;
+                if ( dice < 62 ) {
+                    if ( auto view = v->view(rng( ) % baselineSlots) )
+                        view( ).field_1++;
+                } else if ( dice < 74 ) {
+                    if ( auto [view, inserted] = v->allocate( ); inserted )
+                        view( ).field_3.assign(fmt::format("{}_{}", w, n));
+                } else if ( dice < 99 ) {
+                    v->deallocate(rng( ) % baselineSlots);
+                } else {
+                    v->deallocate([] (const Data& d) { return d.field_3.starts_with("0_"); });
+                }
+            }
+        });
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * ops * pool.size( )));
+}
+
+template<template<class, size_t> class V>
+void baseline_scan (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    ThreadPool pool {static_cast<size_t>(state.range(0))};
+    auto       v = std::make_unique<V<Data, baselineSlots>>( );
+    baseline_fill(*v, pool, baselineSlots);
+    perf.start( );
+    for ( auto _: state )
+        pool.run([&v] (size_t) { benchmark::DoNotOptimize(v->deallocate([] (const Data& d) { return d.field_1 < 0; })); });
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * baselineSlots * pool.size( )));
+}
+
+template<template<class, size_t> class V>
+void register_baseline (std::string_view name)
+{
+    using Fn = void (*)(benchmark::State&);
+    const std::array<std::pair<const char*, Fn>, 4> workloads {{{"allocate", baseline_allocate<V>}, {"view", baseline_view<V>}, {"mixed", baseline_mixed<V>}, {"scan", baseline_scan<V>}}};
+    for ( auto [workload, fn]: workloads )
+        benchmark::RegisterBenchmark(fmt::format("baseline {}/{}", workload, name).c_str( ), fn)->ArgName("threads")->Arg(1)->Arg(4)->Arg(16)->Unit(benchmark::kMillisecond)->UseRealTime( );
+}
+
+const bool baselines_registered = [] {
+    register_baseline<Vault>("vault");
+    register_baseline<MutexFreeListVault>("vector_mutex");
+    register_baseline<SharedMutexMapVault>("map_shared_mutex");
+    register_baseline<ShardedMap>("sharded_map");
+    return true;
+}( );
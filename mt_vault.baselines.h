@@ -0,0 +1,389 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "my_vault.h"
+
+// Reference implementations of the Vault API built the ways callers usually propose instead of Vault, for the
+// comparison benchmarks in mt_vault.baselines.benchmark.cpp. They offer the subset the benchmarks use: allocate(),
+// view(idx), deallocate(idx), deallocate(pred) and capacity(), with an ElementView that holds whatever lock grants
+// access to the element. Like Vault, deallocation only marks a slot free and leaves the payload in place.
+
+// std::vector of slots with a free index stack, everything behind one global mutex; a view holds the global lock
+template<class ElementData, size_t COUNT = 1024>
+class MutexFreeListVault
+{
+    std::vector<ElementData> slots;
+    std::vector<char>        inUse;
+    std::vector<size_t>      freeList;
+    std::mutex               access;
+
+public:
+    class ElementView
+    {
+        std::unique_lock<std::mutex> lock;
+        ElementData*                 ref {nullptr};
+        size_t                       idx {COUNT};
+
+        friend class MutexFreeListVault;
+
+    public:
+        ElementView( ) = default;
+
+        ElementData& operator( ) ( ) { return *ref; }
+
+        operator bool ( ) const { return ref != nullptr; }
+
+        [[nodiscard]] size_t index ( ) const { return idx; }
+    };
+
+    MutexFreeListVault( ) : slots(COUNT), inUse(COUNT, false)
+    {
+        freeList.reserve(COUNT);
+        for ( size_t i = COUNT; i > 0; i-- )
+            freeList.push_back(i - 1);  // lowest index on top, first-fit like Vault
+    }
+
+    std::pair<ElementView, bool> allocate ( )
+    {
+        ElementView v;
+        v.lock = std::unique_lock {access};
+        if ( freeList.empty( ) )
+            return {ElementView { }, false};
+        v.idx = freeList.back( );
+        freeList.pop_back( );
+        inUse[v.idx] = true;
+        v.ref        = &slots[v.idx];
+        return {std::move(v), true};
+    }
+
+    ElementView view (size_t idx)
+    {
+        ElementView v;
+        v.lock = std::unique_lock {access};
+        if ( inUse.at(idx) ) {
+            v.ref = &slots[idx];
+            v.idx = idx;
+        }
+        return v;
+    }
+
+    bool deallocate (size_t idx)
+    {
+        std::unique_lock _ {access};
+        if ( !inUse.at(idx) )
+            return false;
+        inUse[idx] = false;
+        freeList.push_back(idx);
+        return true;
+    }
+
+    bool deallocate (const std::function<bool(const ElementData&)>& pred)
+    {
+        std::unique_lock _ {access};
+        for ( size_t i = 0; i < COUNT; i++ ) {
+            if ( inUse[i] && pred(slots[i]) ) {
+                inUse[i] = false;
+                freeList.push_back(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+};
+
+// std::unordered_map from index to element under a std::shared_mutex: allocation and deallocation take it exclusively,
+// views take it shared plus the mutex of the entry, which node based maps keep at a stable address.
+// A thread holding a view must not allocate or deallocate, that would wait for its own shared lock.
+template<class ElementData, size_t COUNT = 1024>
+class SharedMutexMapVault
+{
+    struct Entry {
+        ElementData data;
+        std::mutex  access;
+    };
+
+    std::unordered_map<size_t, Entry> map;
+    std::vector<size_t>               freeList;
+    std::shared_mutex                 access;
+
+public:
+    class ElementView
+    {
+        std::shared_lock<std::shared_mutex> mapLock;
+        std::unique_lock<std::mutex>        lock;
+        ElementData*                        ref {nullptr};
+        size_t                              idx {COUNT};
+
+        friend class SharedMutexMapVault;
+
+    public:
+        ElementView( ) = default;
+
+        ElementData& operator( ) ( ) { return *ref; }
+
+        operator bool ( ) const { return ref != nullptr; }
+
+        [[nodiscard]] size_t index ( ) const { return idx; }
+    };
+
+    SharedMutexMapVault( )
+    {
+        map.reserve(COUNT);
+        freeList.reserve(COUNT);
+        for ( size_t i = COUNT; i > 0; i-- )
+            freeList.push_back(i - 1);
+    }
+
+    // the new entry is inserted under the exclusive lock, which is then traded for a shared one to hand out the view
+    std::pair<ElementView, bool> allocate ( )
+    {
+        size_t idx;
+        {
+            std::unique_lock _ {access};
+            if ( freeList.empty( ) )
+                return {ElementView { }, false};
+            idx = freeList.back( );
+            freeList.pop_back( );
+            map.try_emplace(idx);
+        }
+        ElementView v {view(idx)};
+        const bool  ok = v;  // false if deallocated in between
+        return {std::move(v), ok};
+    }
+
+    ElementView view (size_t idx)
+    {
+        ElementView v;
+        v.mapLock = std::shared_lock {access};
+        if ( auto i = map.find(idx); i != map.end( ) ) {
+            v.lock = std::unique_lock {i->second.access};
+            v.ref  = &i->second.data;
+            v.idx  = idx;
+        }
+        return v;
+    }
+
+    bool deallocate (size_t idx)
+    {
+        std::unique_lock _ {access};
+        if ( map.erase(idx) == 0 )
+            return false;
+        freeList.push_back(idx);
+        return true;
+    }
+
+    bool deallocate (const std::function<bool(const ElementData&)>& pred)
+    {
+        std::unique_lock _ {access};
+        for ( auto i = map.begin( ); i != map.end( ); ++i ) {
+            if ( pred(i->second.data) ) {
+                freeList.push_back(i->first);
+                map.erase(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+};
+
+// SHARDS independent std::unordered_map + mutex pairs, index i living in shard i % SHARDS; allocation starts at a per
+// thread home shard and moves on while shards are full, predicate scans lock one shard at a time
+template<class ElementData, size_t COUNT = 1024, size_t SHARDS = 16>
+class ShardedMapVault
+{
+    struct alignas(64) Shard {
+        std::mutex                              access;
+        std::unordered_map<size_t, ElementData> map;
+        std::vector<size_t>                     freeList;
+    };
+
+    std::array<Shard, SHARDS> shards;
+
+    static size_t home ( )
+    {
+        thread_local const size_t s = std::hash<std::thread::id> { }(std::this_thread::get_id( )) % SHARDS;
+        return s;
+    }
+
+public:
+    class ElementView
+    {
+        std::unique_lock<std::mutex> lock;
+        ElementData*                 ref {nullptr};
+        size_t                       idx {COUNT};
+
+        friend class ShardedMapVault;
+
+    public:
+        ElementView( ) = default;
+
+        ElementData& operator( ) ( ) { return *ref; }
+
+        operator bool ( ) const { return ref != nullptr; }
+
+        [[nodiscard]] size_t index ( ) const { return idx; }
+    };
+
+    ShardedMapVault( )
+    {
+        for ( size_t i = COUNT; i > 0; i-- )
+            shards[(i - 1) % SHARDS].freeList.push_back(i - 1);
+        for ( auto& s: shards )
+            s.map.reserve(s.freeList.size( ));
+    }
+
+    std::pair<ElementView, bool> allocate ( )
+    {
+        for ( size_t n = 0, s = home( ); n < SHARDS; n++, s = (s + 1) % SHARDS ) {
+            Shard&      shard = shards[s];
+            ElementView v;
+            v.lock = std::unique_lock {shard.access};
+            if ( shard.freeList.empty( ) )
+                continue;
+            v.idx = shard.freeList.back( );
+            shard.freeList.pop_back( );
+            v.ref = &shard.map[v.idx];
+            return {std::move(v), true};
+        }
+        return {ElementView { }, false};
+    }
+
+    ElementView view (size_t idx)
+    {
+        if ( idx >= COUNT )
+            throw std::out_of_range {"no such slot"};
+        Shard&      shard = shards[idx % SHARDS];
+        ElementView v;
+        v.lock = std::unique_lock {shard.access};
+        if ( auto i = shard.map.find(idx); i != shard.map.end( ) ) {
+            v.ref = &i->second;
+            v.idx = idx;
+        }
+        return v;
+    }
+
+    bool deallocate (size_t idx)
+    {
+        if ( idx >= COUNT )
+            throw std::out_of_range {"no such slot"};
+        Shard&           shard = shards[idx % SHARDS];
+        std::unique_lock _ {shard.access};
+        if ( shard.map.erase(idx) == 0 )
+            return false;
+        shard.freeList.push_back(idx);
+        return true;
+    }
+
+    bool deallocate (const std::function<bool(const ElementData&)>& pred)
+    {
+        for ( auto& shard: shards ) {
+            std::unique_lock _ {shard.access};
+            for ( auto i = shard.map.begin( ); i != shard.map.end( ); ++i ) {
+                if ( pred(i->second) ) {
+                    shard.freeList.push_back(i->first);
+                    shard.map.erase(i);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+};
+
+// What Vault users write to look elements up by key: the values in a Vault, a std::unordered_map from key to slot index
+// under one mutex next to it. Counterpart of VaultMap for mt_vault.map.benchmark.cpp, with the same insert(), find(),
+// erase() and upsert(); the map lock is held while the slot is allocated, freed or located, not while a view is open.
+template<class K, class V, size_t COUNT = 1024>
+class WrappedMapVault
+{
+    using Base = Vault<V, COUNT>;
+
+    Base                          vault;
+    std::unordered_map<K, size_t> index;
+    std::mutex                    access;
+
+public:
+    class View
+    {
+        std::optional<typename Base::ElementView> view;
+
+        friend class WrappedMapVault;
+
+    public:
+        operator bool ( ) const { return view && *view; }
+
+        V& operator( ) ( ) { return (*view)( ); }
+    };
+
+    bool insert (const K& key, V value)
+    {
+        std::unique_lock _ {access};
+        if ( index.contains(key) )
+            return false;
+        auto [v, inserted] = vault.allocate( );
+        if ( !inserted )
+            return false;
+        v( ) = std::move(value);
+        index.emplace(key, v.index( ));
+        return true;
+    }
+
+    View find (const K& key)
+    {
+        size_t idx;
+        {
+            std::unique_lock _ {access};
+            const auto       i = index.find(key);
+            if ( i == index.end( ) )
+                return View { };
+            idx = i->second;
+        }
+        View v;
+        v.view.emplace(vault.view(idx));
+        return v;
+    }
+
+    bool erase (const K& key)
+    {
+        std::unique_lock _ {access};
+        const auto       i = index.find(key);
+        if ( i == index.end( ) )
+            return false;
+        vault.deallocate(i->second);
+        index.erase(i);
+        return true;
+    }
+
+    bool upsert (const K& key, V value)
+    {
+        std::unique_lock _ {access};
+        if ( const auto i = index.find(key); i != index.end( ) ) {
+            vault.view(i->second)( ) = std::move(value);
+            return true;
+        }
+        auto [v, inserted] = vault.allocate( );
+        if ( !inserted )
+            return false;
+        v( ) = std::move(value);
+        index.emplace(key, v.index( ));
+        return true;
+    }
+
+    [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+};
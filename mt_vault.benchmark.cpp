@@ -2,56 +2,61 @@
 #include <fmt/format.h>
 #include <fmt/ostream.h>
 
-#include <thread>
+#include <random>
 
+#include "mt_vault.benchmark.h"
+#include "mt_vault.harness.h"
+#include "mt_vault.perf.h"
 #include "my_vault.h"
+#include "my_vault_percpu.h"
+#include "my_vault_tenants.h"
 
-struct Data {
-    int         field_1 {0};
-    std::string field_3;
-};
+const bool topology_context = [] {
+    benchmark::AddCustomContext("cpu_topology", CpuTopology::system( ).describe( ));
+    return true;
+}( );
 
-std::ostream& operator<< (std::ostream& st, const Data& data)
-{
-    fmt::print(st, "s: {}  i: {}", data.field_3, data.field_1);
-    return st;
-}
-
-template<size_t S>
+template<size_t S, Pinning P = Pinning::none>
 void allocate_benchmark (benchmark::State& state)
 {
+    PerfScope perf {state};
+
     const size_t       tCount {static_cast<size_t>(state.range(0))};
     const size_t       count_per_thread = S / tCount;
     std::atomic_size_t allocations {0};
     std::atomic_size_t failures {0};
 
-    std::vector<std::jthread> thr;
-    thr.reserve(tCount);
+    ThreadPool                      pool {tCount, P};
+    std::unique_ptr<Vault<Data, S>> v;
 
-    for ( auto _: state ) {
-        std::unique_ptr<Vault<Data, S>> v = std::make_unique<Vault<Data, S>>( );
-        for ( size_t i = 0; i < tCount; i++ ) {
-            thr.emplace_back([&v, &allocations, &failures, &i, &count_per_thread] ( ) {
-                for ( size_t n = 0; n < count_per_thread; n++ ) {
-                    if ( auto [view, inserted] = v->allocate( ); inserted ) {
-                        view( ).field_3.assign(fmt::format("{}_{}", i + 1, n + 1));
-                        view( ).field_1 = 0;
-                        allocations.fetch_add(1);
-                        // long_lasting_op( );
-                    } else {
-                        failures.fetch_add(1);
-                    }
-                }
-            });
+    const ThreadPool::Task fill = [&v, &allocations, &failures, &count_per_thread] (size_t i) {
+        for ( size_t n = 0; n < count_per_thread; n++ ) {
+            if ( auto [view, inserted] = v->allocate( ); inserted ) {
+                view( ).field_3.assign(fmt::format("{}_{}", i + 1, n + 1));
+                view( ).field_1 = 0;
+                allocations.fetch_add(1);
+                // long_lasting_op( );
+            } else {
+                failures.fetch_add(1);
+            }
         }
-        for ( auto& t: thr )
-            t.join( );
-        thr.clear( );
+    };
+
+    perf.start( );
+    for ( auto _: state ) {
+        perf.pause( );
+        v = std::make_unique<Vault<Data, S>>( );
+        perf.resume( );
+        pool.run(fill);
     }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(allocations.load( ) + failures.load( )));
 
     state.counters["allocated"] = allocations.load( ) / state.iterations( );
     state.counters["failures"]  = failures.load( ) / state.iterations( );
 
+    if constexpr ( P != Pinning::none )
+        state.SetLabel(pool.describe( ));
     state.SetComplexityN(tCount);
 }
 
@@ -62,3 +67,509 @@ BENCHMARK(allocate_benchmark<1024 * 16>)->Name("allocating 16K")->Unit(benchmark
 BENCHMARK(allocate_benchmark<1024 * 32>)->Name("allocating 32K")->Unit(benchmark::kMillisecond)->RangeMultiplier(2)->Range(1, 128)->Complexity( );
 BENCHMARK(allocate_benchmark<1024 * 64>)->Name("allocating 64K")->Unit(benchmark::kMillisecond)->RangeMultiplier(2)->Range(1, 128)->Complexity( );
 BENCHMARK(allocate_benchmark<1024 * 128>)->Name("allocating 128K")->Unit(benchmark::kMillisecond)->RangeMultiplier(2)->Range(1, 128)->Complexity( );
+
+BENCHMARK(allocate_benchmark<1024 * 16, Pinning::compact>)->Name("allocating 16K compact")->Unit(benchmark::kMillisecond)->RangeMultiplier(2)->Range(1, 128)->UseRealTime( );
+BENCHMARK(allocate_benchmark<1024 * 16, Pinning::scatter>)->Name("allocating 16K scatter")->Unit(benchmark::kMillisecond)->RangeMultiplier(2)->Range(1, 128)->UseRealTime( );
+BENCHMARK(allocate_benchmark<1024 * 16, Pinning::one_per_core>)->Name("allocating 16K one_per_core")->Unit(benchmark::kMillisecond)->RangeMultiplier(2)->Range(1, 128)->UseRealTime( );
+BENCHMARK(allocate_benchmark<1024 * 16, Pinning::cross_socket>)->Name("allocating 16K cross_socket")->Unit(benchmark::kMillisecond)->RangeMultiplier(2)->Range(1, 128)->UseRealTime( );
+
+// first-match search with the only match in the last slot, the worst case of deallocate(pred); threads:1 is the plain
+// sequential sweep
+template<size_t S>
+void find_first_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    for ( size_t n = 0; n < S; n++ )
+        if ( auto [view, inserted] = v->allocate( ); inserted )
+            view( ).field_1 = static_cast<int>(view.index( ));
+
+    const auto threads = static_cast<size_t>(state.range(0));
+    perf.start( );
+    for ( auto _: state )
+        benchmark::DoNotOptimize(v->find_first([] (const Data& d) { return d.field_1 == static_cast<int>(S - 1); }, threads).index( ));
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * S));
+}
+
+BENCHMARK(find_first_benchmark<1024 * 64>)->Name("find first 64K")->Unit(benchmark::kMillisecond)->ArgName("threads")->RangeMultiplier(2)->Range(1, 16)->UseRealTime( );
+
+// draining a full vault from all workers: try_consume() against the begin() + deallocate(idx) loop it replaces
+template<size_t S, bool CONSUME>
+void drain_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    ThreadPool                      pool {static_cast<size_t>(state.range(0))};
+    std::unique_ptr<Vault<Data, S>> v;
+    std::atomic_size_t              taken {0};
+
+    const ThreadPool::Task drain = [&v, &taken] (size_t) {
+        if constexpr ( CONSUME ) {
+            while ( v->try_consume([] (Data& d) { benchmark::DoNotOptimize(std::move(d.field_3)); }) )
+                taken.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            for ( ;; ) {
+                auto i = v->begin( );
+                if ( i == v->end( ) )
+                    break;
+                const size_t idx = (*i).index( );  // the view must be gone before deallocate() locks the element
+                if ( v->deallocate(idx) )
+                    taken.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    perf.start( );
+    for ( auto _: state ) {
+        perf.pause( );
+        v = std::make_unique<Vault<Data, S>>( );
+        for ( size_t n = 0; n < S; n++ )
+            if ( auto [view, inserted] = v->allocate( ); inserted )
+                view( ).field_3.assign(fmt::format("item_{}", n));
+        perf.resume( );
+        pool.run(drain);
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(taken.load( )));
+}
+
+BENCHMARK(drain_benchmark<1024 * 4, false>)->Name("drain 4K iterate")->Unit(benchmark::kMillisecond)->ArgName("threads")->RangeMultiplier(4)->Range(1, 16)->UseRealTime( );
+BENCHMARK(drain_benchmark<1024 * 4, true>)->Name("drain 4K try_consume")->Unit(benchmark::kMillisecond)->ArgName("threads")->RangeMultiplier(4)->Range(1, 16)->UseRealTime( );
+
+// visiting one category out of 16: tag bitmap scan against iterating everything and filtering on the payload
+template<size_t S, bool TAGGED>
+void category_scan_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t groups = 16;
+    auto             v      = std::make_unique<Vault<Data, S, 1>>( );
+    for ( size_t n = 0; n < S; n++ ) {
+        if ( auto [view, inserted] = v->allocate( ); inserted ) {
+            view( ).field_3.assign(fmt::format("{}_{}", n % groups, n));
+            if ( n % groups == 3 )
+                view.tag(0);
+        }
+    }
+
+    size_t visited {0};
+    perf.start( );
+    for ( auto _: state ) {
+        if constexpr ( TAGGED ) {
+            v->for_each_tagged(0, [&visited] (auto& view) { visited += static_cast<size_t>(view( ).field_1 == 0); });
+        } else {
+            for ( auto i = v->begin( ); i != v->end( ); ++i ) {
+                auto view = *i;
+                if ( view && view( ).field_3.starts_with("3_") )
+                    visited += static_cast<size_t>(view( ).field_1 == 0);
+            }
+        }
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(visited));
+}
+
+BENCHMARK(category_scan_benchmark<1024 * 16, false>)->Name("category scan 16K iterate")->Unit(benchmark::kMicrosecond);
+BENCHMARK(category_scan_benchmark<1024 * 16, true>)->Name("category scan 16K tagged")->Unit(benchmark::kMicrosecond);
+
+// picking 16 random live slots out of a half full vault: rank/select directory against counting and walking with the
+// iterator; the vault does not change between iterations, so the directory is built once
+template<size_t S, bool RANKS>
+void sample_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    for ( size_t n = 0; n < S; n++ )
+        v->allocate( );
+    for ( size_t idx = 0; idx < S; idx += 2 )
+        v->deallocate(idx);
+
+    std::mt19937_64 rng {1};
+    perf.start( );
+    for ( auto _: state ) {
+        if constexpr ( RANKS ) {
+            benchmark::DoNotOptimize(v->sample(16, rng));
+        } else {
+            const auto          n = static_cast<size_t>(std::count_if(v->begin( ), v->end( ), [] (auto) { return true; }));
+            std::vector<size_t> ranks(16);
+            for ( auto& r: ranks )
+                r = rng( ) % n;
+            std::ranges::sort(ranks);
+            std::vector<size_t> slots;
+            size_t              rank {0};
+            for ( auto i = v->begin( ); i != v->end( ) && slots.size( ) < ranks.size( ); ++i, rank++ )
+                while ( slots.size( ) < ranks.size( ) && ranks[slots.size( )] == rank )
+                    slots.push_back((*i).index( ));
+            benchmark::DoNotOptimize(slots);
+        }
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * 16));
+}
+
+BENCHMARK(sample_benchmark<1024 * 16, false>)->Name("sample 16 of 16K iterate")->Unit(benchmark::kMicrosecond);
+BENCHMARK(sample_benchmark<1024 * 16, true>)->Name("sample 16 of 16K rank/select")->Unit(benchmark::kMicrosecond);
+
+// rewriting 4096 consecutive slots: one lock_range() against a view per element
+template<size_t S, bool RANGE>
+void range_rewrite_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t begin = 4096;
+    constexpr size_t end   = 8192;
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    for ( size_t n = 0; n < S; n++ )
+        v->allocate( );
+
+    perf.start( );
+    for ( auto _: state ) {
+        if constexpr ( RANGE ) {
+            v->lock_range(begin, end).for_each([] (size_t, Data& d) { d.field_1++; });
+        } else {
+            for ( size_t idx = begin; idx < end; idx++ )
+                if ( auto view = v->view(idx) )
+                    view( ).field_1++;
+        }
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * (end - begin)));
+}
+
+BENCHMARK(range_rewrite_benchmark<1024 * 16, false>)->Name("range rewrite 4K views")->Unit(benchmark::kMicrosecond);
+BENCHMARK(range_rewrite_benchmark<1024 * 16, true>)->Name("range rewrite 4K lock_range")->Unit(benchmark::kMicrosecond);
+
+// worker 0 keeps snapshotting the lower half of the vault while the others update random elements of the upper half:
+// a vault level shared lock stalls them for every snapshot, shared block locks of the snapshot range do not
+template<size_t S, bool BLOCKS>
+void snapshot_traffic_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t updates = 4096;
+
+    ThreadPool pool {static_cast<size_t>(state.range(0))};
+    auto       v = std::make_unique<Vault<Data, S>>( );
+    for ( size_t n = 0; n < S; n++ )
+        v->allocate( );
+
+    perf.start( );
+    for ( auto _: state ) {
+        std::atomic_bool done {false};
+        pool.run([&v, &done, &pool] (size_t w) {
+            if ( w == 0 ) {
+                std::vector<int> snapshot;
+                while ( !done ) {
+                    snapshot.clear( );
+                    auto guard = BLOCKS ? v->lock_range_shared(0, S / 2) : v->lock_all_shared( );
+                    guard.for_each([&snapshot] (size_t idx, const Data& d) {
+                        if ( idx < S / 2 )
+                            snapshot.push_back(d.field_1);
+                    });
+                    benchmark::DoNotOptimize(snapshot);
+                }
+                return;
+            }
+            std::mt19937_64 rng {w};
+            for ( size_t n = 0; n < updates; n++ )
+                if ( auto view = v->view(S / 2 + rng( ) % (S / 2)) )
+                    view( ).field_1++;
+            if ( w == pool.size( ) - 1 )
+                done = true;
+        });
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * updates * (pool.size( ) - 1)));
+}
+
+BENCHMARK(snapshot_traffic_benchmark<1024 * 16, false>)->Name("snapshot traffic 16K lock_all_shared")->ArgName("threads")->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime( );
+BENCHMARK(snapshot_traffic_benchmark<1024 * 16, true>)->Name("snapshot traffic 16K lock_range_shared")->ArgName("threads")->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime( );
+
+// views of random slots of a half full vault, the free ones reported by the exception of ElementView::operator() against
+// the error of try_view()
+template<size_t S, bool EXPECTED>
+void half_free_view_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    for ( size_t n = 0; n < S; n++ )
+        v->allocate( );
+    for ( size_t n = 0; n < S; n += 2 )
+        v->deallocate(n);
+
+    std::mt19937_64 rng {1};
+    size_t          missing {0};
+    perf.start( );
+    for ( auto _: state ) {
+        const size_t idx = rng( ) % S;
+        if constexpr ( EXPECTED ) {
+            if ( auto view = v->try_view(idx) )
+                (*view)->field_1++;
+            else
+                missing++;
+        } else {
+            try {
+                v->view(idx)( ).field_1++;
+            } catch ( const std::out_of_range& ) {
+                missing++;
+            }
+        }
+    }
+    perf.stop( );
+    benchmark::DoNotOptimize(missing);
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( )));
+}
+
+BENCHMARK(half_free_view_benchmark<1024 * 16, false>)->Name("half free view 16K exception");
+BENCHMARK(half_free_view_benchmark<1024 * 16, true>)->Name("half free view 16K expected");
+
+// Allocate/deallocate churn on a half full vault from threads that live for 64 pairs only, or from a persistent pool:
+// the plain vault scans from its first slot, the front ends of my_vault_percpu.h take slots from per CPU caches or from
+// thread_local ones, which short lived threads never get to warm up
+template<class V, bool SHORT_LIVED>
+void cached_churn_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t S     = 1024 * 64;
+    constexpr size_t pairs = 64;
+    const size_t     tCount {static_cast<size_t>(state.range(0))};
+
+    auto v = std::make_unique<V>( );
+    for ( size_t n = 0; n < S / 2; n++ )
+        v->allocate( );
+
+    const ThreadPool::Task churn = [&v] (size_t) {
+        for ( size_t n = 0; n < pairs; n++ ) {
+            size_t idx;
+            {
+                auto [view, inserted] = v->allocate( );
+                if ( !inserted )
+                    continue;
+                view( ).field_1++;
+                idx = view.index( );
+            }
+            v->deallocate(idx);
+        }
+    };
+    std::unique_ptr<ThreadPool> pool;
+    if constexpr ( !SHORT_LIVED )
+        pool = std::make_unique<ThreadPool>(tCount);
+    perf.start( );
+    for ( auto _: state ) {
+        if constexpr ( SHORT_LIVED ) {
+            std::vector<std::jthread> thr;
+            for ( size_t i = 0; i < tCount; i++ )
+                thr.emplace_back(churn, i);
+        } else {
+            pool->run(churn);
+        }
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * tCount * pairs));
+}
+
+BENCHMARK(cached_churn_benchmark<Vault<Data, 1024 * 64>, true>)->Name("churn short lived/vault")->ArgName("threads")->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+BENCHMARK(cached_churn_benchmark<CachedVault<Data, 1024 * 64, FreeCache::per_thread>, true>)->Name("churn short lived/thread_local")->ArgName("threads")->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+BENCHMARK(cached_churn_benchmark<CachedVault<Data, 1024 * 64, FreeCache::per_cpu>, true>)->Name("churn short lived/per_cpu")->ArgName("threads")->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+BENCHMARK(cached_churn_benchmark<Vault<Data, 1024 * 64>, false>)->Name("churn pool/vault")->ArgName("threads")->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+BENCHMARK(cached_churn_benchmark<CachedVault<Data, 1024 * 64, FreeCache::per_thread>, false>)->Name("churn pool/thread_local")->ArgName("threads")->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+BENCHMARK(cached_churn_benchmark<CachedVault<Data, 1024 * 64, FreeCache::per_cpu>, false>)->Name("churn pool/per_cpu")->ArgName("threads")->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+
+// An expiry thread freeing every slot in turn while readers keep views of random slots for 20us each: deallocate(idx)
+// waits for the reader of the slot it is at, deallocate_deferred(idx) leaves the slot to it and moves on
+template<size_t S, bool DEFERRED>
+void expiry_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+
+    std::vector<std::jthread> readers;
+    for ( int64_t i = 0; i < state.range(0); i++ ) {
+        readers.emplace_back([&v, i] (std::stop_token st) {
+            std::mt19937_64 rng {static_cast<uint64_t>(i)};
+            while ( !st.stop_requested( ) ) {
+                if ( auto view = v->view(rng( ) % S) ) {
+                    for ( const auto until = std::chrono::steady_clock::now( ) + 20us; std::chrono::steady_clock::now( ) < until; )
+                        view( ).field_1++;
+                }
+            }
+        });
+    }
+    size_t idx {S};
+    perf.start( );
+    for ( auto _: state ) {
+        if ( idx == S ) {
+            perf.pause( );
+            while ( v->allocate( ).second ) { }
+            idx = 0;
+            perf.resume( );
+        }
+        if constexpr ( DEFERRED )
+            benchmark::DoNotOptimize(v->deallocate_deferred(idx++));
+        else
+            benchmark::DoNotOptimize(v->deallocate(idx++));
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( )));
+}
+
+BENCHMARK(expiry_benchmark<256, false>)->Name("expiry behind readers/deallocate")->ArgName("readers")->Arg(2)->Arg(8)->UseRealTime( );
+BENCHMARK(expiry_benchmark<256, true>)->Name("expiry behind readers/deallocate_deferred")->ArgName("readers")->Arg(2)->Arg(8)->UseRealTime( );
+
+// Threads placing batches of 8 into a vault with room for 64 more elements, each batch freed right after: reserve()
+// takes the capacity at once or fails without touching a slot, the rollback variant allocates one by one and frees what
+// it got when the batch does not fit
+template<size_t S, bool RESERVE>
+void batch_place_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t batch   = 8;
+    constexpr size_t batches = 64;
+    ThreadPool       pool {static_cast<size_t>(state.range(0))};
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    for ( size_t n = 0; n < S - 64; n++ )
+        v->allocate( );
+
+    std::atomic_size_t placed {0};
+    perf.start( );
+    for ( auto _: state ) {
+        pool.run([&v, &placed] (size_t) {
+            std::array<size_t, batch> taken;
+            for ( size_t n = 0; n < batches; n++ ) {
+                size_t got {0};
+                if constexpr ( RESERVE ) {
+                    if ( auto r = v->reserve(batch) )
+                        for ( ; got < batch; got++ )
+                            taken[got] = v->allocate(r).first.index( );
+                } else {
+                    for ( ; got < batch; got++ ) {
+                        auto [view, inserted] = v->allocate( );
+                        if ( !inserted )
+                            break;
+                        taken[got] = view.index( );
+                    }
+                }
+                placed.fetch_add(got == batch, std::memory_order_relaxed);
+                for ( size_t i = 0; i < got; i++ )
+                    v->deallocate(taken[i]);
+            }
+        });
+    }
+    perf.stop( );
+    state.counters["placed"] = benchmark::Counter(static_cast<double>(placed.load( )) / static_cast<double>(state.iterations( ) * batches * pool.size( )));
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * batches * pool.size( )));
+}
+
+BENCHMARK(batch_place_benchmark<1024 * 16, false>)->Name("batch place 16K/rollback")->ArgName("threads")->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+BENCHMARK(batch_place_benchmark<1024 * 16, true>)->Name("batch place 16K/reserve")->ArgName("threads")->Arg(4)->Arg(16)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+
+// allocate/deallocate pairs on a vault kept at half its capacity, with watermarks set around it or not set at all; the
+// pairs never cross them, so both should cost the same
+template<size_t S, bool WATERMARKS>
+void watermark_churn_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    for ( size_t n = 0; n < S / 2; n++ )
+        v->allocate( );
+    if constexpr ( WATERMARKS )
+        v->set_watermarks(S / 4, S * 3 / 4, [] (Watermark, size_t) { });
+
+    perf.start( );
+    for ( auto _: state ) {
+        auto [view, inserted] = v->allocate( );
+        v->deallocate(view);
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( )));
+}
+
+BENCHMARK(watermark_churn_benchmark<1024, false>)->Name("watermark churn 1K/none");
+BENCHMARK(watermark_churn_benchmark<1024, true>)->Name("watermark churn 1K/set");
+
+// Allocate/deallocate pairs of one tenant from many threads, its quota counted in per thread stripes or in a single one;
+// the vault is half full, the tenant well within its quota and placing into the empty half as its partition
+template<size_t STRIPES>
+void tenant_churn_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t S     = 1024 * 64;
+    constexpr size_t pairs = 256;
+    ThreadPool       pool {static_cast<size_t>(state.range(0))};
+
+    auto v = std::make_unique<TenantVault<Data, S, 4, STRIPES>>( );
+    v->set_quota(0, S / 4, S / 4);
+    v->set_partition(0, S / 2, S);
+    for ( size_t n = 0; n < S / 2; n++ )
+        v->allocate(1);
+
+    perf.start( );
+    for ( auto _: state ) {
+        pool.run([&v] (size_t) {
+            for ( size_t n = 0; n < pairs; n++ ) {
+                size_t idx;
+                {
+                    auto [view, inserted] = v->allocate(0);
+                    if ( !inserted )
+                        continue;
+                    idx = view.index( );
+                }
+                v->deallocate(idx);
+            }
+        });
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * pairs * pool.size( )));
+}
+
+BENCHMARK(tenant_churn_benchmark<1>)->Name("tenant churn/one stripe")->ArgName("threads")->Arg(16)->Arg(128)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+BENCHMARK(tenant_churn_benchmark<32>)->Name("tenant churn/32 stripes")->ArgName("threads")->Arg(16)->Arg(128)->Unit(benchmark::kMicrosecond)->UseRealTime( );
+
+// A latency critical thread allocating and freeing while batch threads keep a full vault churning: without headroom it
+// competes with them for every freed slot, with 1% kept for Priority::high it always finds one
+template<size_t S, size_t HEADROOM_PERCENT>
+void priority_headroom_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    v->set_headroom_percent(HEADROOM_PERCENT);
+    while ( v->allocate( ).second ) { }
+
+    std::vector<std::jthread> batch;
+    for ( int64_t i = 0; i < state.range(0); i++ ) {
+        batch.emplace_back([&v, i] (std::stop_token st) {
+            std::mt19937_64 rng {static_cast<uint64_t>(i)};
+            while ( !st.stop_requested( ) ) {
+                v->deallocate(rng( ) % S);
+                v->allocate( );
+            }
+        });
+    }
+    size_t placed {0};
+    perf.start( );
+    for ( auto _: state ) {
+        auto [view, inserted] = v->allocate(Priority::high);
+        if ( inserted ) {
+            placed++;
+            v->deallocate(view);
+        }
+    }
+    perf.stop( );
+    state.counters["placed"] = benchmark::Counter(static_cast<double>(placed) / static_cast<double>(state.iterations( )));
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( )));
+}
+
+BENCHMARK(priority_headroom_benchmark<1024 * 16, 0>)->Name("priority near full/no headroom")->ArgName("batch")->Arg(2)->Arg(8)->UseRealTime( );
+BENCHMARK(priority_headroom_benchmark<1024 * 16, 1>)->Name("priority near full/1% headroom")->ArgName("batch")->Arg(2)->Arg(8)->UseRealTime( );
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// shared by the benchmark translation units of mt_vault.benchmark and by mt_vault.loadgen
+
+struct Data {
+    int         field_1 {0};
+    std::string field_3;
+};
+
+inline std::ostream& operator<< (std::ostream& st, const Data& data)
+{
+    fmt::print(st, "s: {}  i: {}", data.field_3, data.field_1);
+    return st;
+}
+
+// exactly N bytes, the first 8 of them used as a key; TRIVIAL=false only adds user provided copy and destruction
+template<size_t N, bool TRIVIAL>
+struct Payload {
+    static_assert(N >= sizeof(uint64_t));
+
+    std::array<std::byte, N> bytes { };
+
+    Payload( ) = default;
+
+    Payload(const Payload&)
+        requires TRIVIAL
+    = default;
+
+    Payload(const Payload& o)
+        requires (!TRIVIAL)
+        : bytes {o.bytes}
+    { }
+
+    Payload& operator= (const Payload&)
+        requires TRIVIAL
+    = default;
+
+    Payload& operator= (const Payload& o)
+        requires (!TRIVIAL)
+    {
+        bytes = o.bytes;
+        return *this;
+    }
+
+    ~Payload( )
+        requires TRIVIAL
+    = default;
+
+    ~Payload( )
+        requires (!TRIVIAL)
+    { }
+
+    [[nodiscard]] uint64_t key ( ) const
+    {
+        uint64_t k;
+        std::memcpy(&k, bytes.data( ), sizeof(k));
+        return k;
+    }
+
+    void assign (uint64_t k)
+    {
+        std::memcpy(bytes.data( ), &k, sizeof(k));
+        bytes.back( ) = static_cast<std::byte>(k);
+    }
+};
+
+// resident part of [p, p + size), from mincore(2); unlike process RSS it is not hidden by the allocator reusing freed memory
+inline size_t resident_bytes (const void* p, size_t size)
+{
+    const auto page  = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto begin = reinterpret_cast<uintptr_t>(p) & ~(page - 1);
+    const auto end   = (reinterpret_cast<uintptr_t>(p) + size + page - 1) & ~(page - 1);
+
+    std::vector<unsigned char> pages((end - begin) / page);
+    if ( mincore(reinterpret_cast<void*>(begin), end - begin, pages.data( )) != 0 )
+        return 0;
+    return static_cast<size_t>(std::ranges::count_if(pages, [] (unsigned char c) { return c & 1; })) * page;
+}
+
+inline double seconds_since (std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now( ) - start).count( );
+}
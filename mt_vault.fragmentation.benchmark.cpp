@@ -0,0 +1,139 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <numeric>
+#include <random>
+
+#include "mt_vault.benchmark.h"
+#include "mt_vault.harness.h"
+#include "mt_vault.perf.h"
+#include "my_vault.h"
+
+// Allocation into a fragmented vault. The vault is filled once, then the same set of slots is freed before every
+// iteration, and the timed part refills exactly those holes. Besides throughput every run reports how many slots an
+// allocation had to examine, the number free slot search strategies are meant to cut.
+
+enum class Fragmentation { uniform, clustered, tail, alternating };
+
+constexpr std::string_view fragmentation_name (Fragmentation f)
+{
+    switch ( f ) {
+        case Fragmentation::uniform: return "uniform";
+        case Fragmentation::clustered: return "clustered";
+        case Fragmentation::tail: return "tail";
+        case Fragmentation::alternating: return "alternating";
+    }
+    return "?";
+}
+
+// indices to free, freePercent of count
+std::vector<size_t> holes (Fragmentation pattern, size_t count, size_t freePercent)
+{
+    constexpr size_t cluster = 64;
+
+    const size_t        h = count * freePercent / 100;
+    std::mt19937_64     rng {42};
+    std::vector<size_t> idx;
+    switch ( pattern ) {
+        case Fragmentation::uniform:
+            idx.resize(count);
+            std::iota(idx.begin( ), idx.end( ), 0);
+            std::shuffle(idx.begin( ), idx.end( ), rng);
+            idx.resize(h);
+            break;
+        case Fragmentation::clustered: {  // runs of 64 free slots at random cluster aligned positions
+            std::vector<size_t> clusters(count / cluster);
+            std::iota(clusters.begin( ), clusters.end( ), 0);
+            std::shuffle(clusters.begin( ), clusters.end( ), rng);
+            for ( size_t c = 0; idx.size( ) < h; c++ )
+                for ( size_t i = 0; i < cluster && idx.size( ) < h; i++ )
+                    idx.push_back(clusters[c] * cluster + i);
+            break;
+        }
+        case Fragmentation::tail:
+            for ( size_t i = count - h; i < count; i++ )
+                idx.push_back(i);
+            break;
+        case Fragmentation::alternating:  // evenly spaced, every other slot at 50%
+            for ( size_t i = 0; i < count && idx.size( ) < h; i += 100 / freePercent )
+                idx.push_back(i);
+            break;
+    }
+    std::ranges::sort(idx);
+    return idx;
+}
+
+template<size_t S, Fragmentation F>
+void fragmented_allocate_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    const auto free    = holes(F, S, static_cast<size_t>(state.range(0)));
+    const auto threads = static_cast<size_t>(state.range(1));
+
+    ThreadPool pool {threads};
+    auto       v = std::make_unique<Vault<Data, S>>( );
+    for ( size_t n = 0; n < S; n++ )
+        if ( auto [view, inserted] = v->allocate( ); inserted )
+            view( ).field_3.assign(fmt::format("0_{}", n));
+
+    std::atomic_size_t failures {0};
+    const auto         refill = [&v, &free, &failures, threads] (size_t w) {
+        for ( size_t n = w; n < free.size( ); n += threads ) {
+            if ( auto [view, inserted] = v->allocate( ); inserted )
+                view( ).field_3.assign(fmt::format("{}_{}", w + 1, n));
+            else
+                failures.fetch_add(1);
+        }
+    };
+
+    size_t scanned {0};
+    size_t allocated {0};
+    perf.start( );
+    for ( auto _: state ) {
+        perf.pause( );
+        for ( size_t idx: free )
+            v->deallocate(idx);
+        const auto before = v->stats( );
+        perf.resume( );
+
+        pool.run(refill);
+
+        perf.pause( );
+        const auto after = v->stats( );
+        scanned += after.scannedSlots - before.scannedSlots;
+        allocated += after.allocations - before.allocations;
+        perf.resume( );
+    }
+    perf.stop( );
+
+    state.SetItemsProcessed(static_cast<int64_t>(allocated));
+    state.counters["holes"]      = static_cast<double>(free.size( ));
+    state.counters["scan/alloc"] = allocated ? static_cast<double>(scanned) / static_cast<double>(allocated) : 0;
+    state.counters["failures"]   = static_cast<double>(failures.load( ));
+}
+
+template<size_t S, Fragmentation F>
+void register_fragmented ( )
+{
+    benchmark::RegisterBenchmark(fmt::format("fragmented {:>2}K {}", S / 1024, fragmentation_name(F)).c_str( ), fragmented_allocate_benchmark<S, F>)
+        ->ArgNames({"free%", "threads"})
+        ->ArgsProduct({{12, 50}, {1, 8}})
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime( );
+}
+
+template<size_t S>
+void register_fragmented_patterns ( )
+{
+    register_fragmented<S, Fragmentation::uniform>( );
+    register_fragmented<S, Fragmentation::clustered>( );
+    register_fragmented<S, Fragmentation::tail>( );
+    register_fragmented<S, Fragmentation::alternating>( );
+}
+
+const bool fragmentation_registered = [] {
+    register_fragmented_patterns<1024 * 16>( );
+    register_fragmented_patterns<1024 * 64>( );
+    return true;
+}( );
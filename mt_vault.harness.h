@@ -0,0 +1,302 @@
+#pragma once
+
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// Benchmark harness: CPU topology, thread placement policies and a persistent pool of pinned worker threads.
+// Workers are created once per benchmark, so thread creation is not part of the timed iterations.
+
+enum class Pinning { none, compact, scatter, one_per_core, cross_socket };
+
+constexpr std::string_view pinning_name (Pinning p)
+{
+    switch ( p ) {
+        case Pinning::none: return "none";
+        case Pinning::compact: return "compact";
+        case Pinning::scatter: return "scatter";
+        case Pinning::one_per_core: return "one_per_core";
+        case Pinning::cross_socket: return "cross_socket";
+    }
+    return "?";
+}
+
+class CpuTopology
+{
+public:
+    struct Cpu {
+        int id {0};
+        int core {0};
+        int package {0};
+        int node {0};
+        int smt {0};       // index among hyperthreads of the same core
+        int coreRank {0};  // index of the core inside its package
+    };
+
+    // CPUs this process may run on, as seen in sysfs; missing entries fall back to one core per CPU on one package
+    static const CpuTopology& system ( )
+    {
+        static const CpuTopology topology = [] {
+            CpuTopology t;
+            cpu_set_t   set;
+            CPU_ZERO(&set);
+            sched_getaffinity(0, sizeof(set), &set);
+            for ( int c = 0; c < CPU_SETSIZE; c++ ) {
+                if ( !CPU_ISSET(c, &set) )
+                    continue;
+                const std::filesystem::path dir {fmt::format("/sys/devices/system/cpu/cpu{}", c)};
+                Cpu                         cpu {.id = c, .core = readInt(dir / "topology/core_id", c), .package = readInt(dir / "topology/physical_package_id", 0)};
+                std::error_code             ec;
+                for ( const auto& entry: std::filesystem::directory_iterator {dir, ec} ) {
+                    const auto name = entry.path( ).filename( ).string( );
+                    if ( name.starts_with("node") )
+                        cpu.node = std::stoi(name.substr(4));
+                }
+                t.cpus.push_back(cpu);
+            }
+            t.rank( );
+            return t;
+        }( );
+        return topology;
+    }
+
+    [[nodiscard]] const std::vector<Cpu>& all ( ) const { return cpus; }
+
+    [[nodiscard]] size_t count (int Cpu::*field) const
+    {
+        std::vector<int> v;
+        for ( const auto& c: cpus )
+            v.push_back(c.*field);
+        std::ranges::sort(v);
+        return static_cast<size_t>(std::ranges::distance(v.begin( ), std::ranges::unique(v).begin( )));
+    }
+
+    [[nodiscard]] std::string describe ( ) const
+    {
+        std::map<std::pair<int, int>, int> cores;
+        for ( const auto& c: cpus )
+            cores[{c.package, c.core}]++;
+        return fmt::format("{} cpus, {} cores, {} packages, {} numa nodes", cpus.size( ), cores.size( ), count(&Cpu::package), count(&Cpu::node));
+    }
+
+    // CPU for each of threads workers; wraps around when there are more threads than CPUs the policy may use
+    [[nodiscard]] std::vector<int> placement (Pinning policy, size_t threads) const
+    {
+        std::vector<Cpu> order {cpus};
+        auto             by = [&order] (auto key) { std::ranges::stable_sort(order, [&key] (const Cpu& a, const Cpu& b) { return key(a) < key(b); }); };
+        switch ( policy ) {
+            case Pinning::none: return std::vector<int>(threads, -1);
+            case Pinning::compact:  // fill SMT siblings, then cores, then the next package
+                by([] (const Cpu& c) { return std::tuple {c.node, c.package, c.core, c.smt}; });
+                break;
+            case Pinning::scatter:  // spread over packages first, then cores, SMT siblings last
+                by([] (const Cpu& c) { return std::tuple {c.smt, c.coreRank, c.package}; });
+                break;
+            case Pinning::one_per_core:  // first sibling of each core only
+                std::erase_if(order, [] (const Cpu& c) { return c.smt != 0; });
+                by([] (const Cpu& c) { return std::tuple {c.package, c.core}; });
+                break;
+            case Pinning::cross_socket:  // consecutive threads alternate packages, compact inside a package
+                by([] (const Cpu& c) { return std::tuple {c.coreRank, c.smt, c.package}; });
+                break;
+        }
+        std::vector<int> result;
+        for ( size_t i = 0; i < threads; i++ )
+            result.push_back(order[i % order.size( )].id);
+        return result;
+    }
+
+private:
+    std::vector<Cpu> cpus;
+
+    static int readInt (const std::filesystem::path& path, int fallback)
+    {
+        std::ifstream f {path};
+        int           v {fallback};
+        return (f >> v) ? v : fallback;
+    }
+
+    void rank ( )
+    {
+        std::map<std::pair<int, int>, int> siblings;
+        std::map<int, std::map<int, int>>  coreRanks;
+        for ( auto& c: cpus ) {
+            c.smt = siblings[{c.package, c.core}]++;
+            coreRanks[c.package].emplace(c.core, 0);
+        }
+        for ( auto& [package, cores]: coreRanks ) {
+            int r {0};
+            for ( auto& [core, rank]: cores )
+                rank = r++;
+        }
+        for ( auto& c: cpus )
+            c.coreRank = coreRanks[c.package][c.core];
+    }
+};
+
+class ThreadPool
+{
+public:
+    using Task = std::function<void(size_t worker)>;
+
+    explicit ThreadPool(size_t threads, Pinning policy = Pinning::none, const CpuTopology& topology = CpuTopology::system( )) :
+        policy {policy}, placement {topology.placement(policy, threads)}
+    {
+        workers.reserve(threads);
+        for ( size_t i = 0; i < threads; i++ ) {
+            workers.emplace_back([this, i] {
+                if ( placement[i] >= 0 ) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(placement[i], &set);
+                    pthread_setaffinity_np(pthread_self( ), sizeof(set), &set);
+                }
+                work(i);
+            });
+        }
+    }
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    ~ThreadPool( )
+    {
+        stopping = true;
+        generation.fetch_add(1);
+        generation.notify_all( );
+    }
+
+    // runs task(worker) once on every worker and returns when all of them are done
+    void run (const Task& t)
+    {
+        task = &t;
+        pending.store(workers.size( ));
+        generation.fetch_add(1);
+        generation.notify_all( );
+        for ( size_t p = pending.load( ); p != 0; p = pending.load( ) )
+            pending.wait(p);
+    }
+
+    [[nodiscard]] size_t size ( ) const { return workers.size( ); }
+
+    [[nodiscard]] std::string describe ( ) const
+    {
+        if ( policy == Pinning::none )
+            return std::string {pinning_name(policy)};
+        return fmt::format("{} cpus={}", pinning_name(policy), fmt::join(placement, ","));
+    }
+
+private:
+    Pinning                   policy;
+    std::vector<int>          placement;
+    const Task*               task {nullptr};
+    std::atomic_size_t        generation {0};
+    std::atomic_size_t        pending {0};
+    std::atomic_bool          stopping {false};
+    std::vector<std::jthread> workers;  // last, so workers are joined before the state above goes away
+
+    void work (size_t i)
+    {
+        for ( size_t seen = 0;; ) {
+            generation.wait(seen);
+            seen = generation.load( );
+            if ( stopping )
+                return;
+            (*task)(i);
+            if ( pending.fetch_sub(1) == 1 )
+                pending.notify_one( );
+        }
+    }
+};
+
+// Log-linear latency histogram in the spirit of HdrHistogram: exact below 64 ns, then 32 sub-buckets per power of two
+// (about 3% relative error). Not thread safe; keep one per worker and merge() them.
+class LatencyHistogram
+{
+    static constexpr unsigned SUB_BITS = 5;
+    static constexpr size_t   SUB      = size_t {1} << SUB_BITS;
+    static constexpr size_t   BUCKETS  = 2 * SUB + 64 * SUB;
+
+    std::array<uint64_t, BUCKETS> counts { };
+    uint64_t                      total {0};
+    uint64_t                      maxValue {0};
+
+    static size_t bucket (uint64_t v)
+    {
+        if ( v < 2 * SUB )
+            return v;
+        const unsigned e = std::bit_width(v) - (SUB_BITS + 1);
+        return 2 * SUB + (e - 1) * SUB + ((v >> e) - SUB);
+    }
+
+    static uint64_t highest (size_t idx)
+    {
+        if ( idx < 2 * SUB )
+            return idx;
+        const size_t   e = (idx - 2 * SUB) / SUB + 1;
+        const uint64_t m = (idx - 2 * SUB) % SUB + SUB;
+        return ((m + 1) << e) - 1;
+    }
+
+public:
+    void record (uint64_t ns)
+    {
+        counts[bucket(ns)]++;
+        total++;
+        maxValue = std::max(maxValue, ns);
+    }
+
+    void merge (const LatencyHistogram& o)
+    {
+        for ( size_t i = 0; i < BUCKETS; i++ )
+            counts[i] += o.counts[i];
+        total += o.total;
+        maxValue = std::max(maxValue, o.maxValue);
+    }
+
+    void reset ( ) { *this = LatencyHistogram { }; }
+
+    [[nodiscard]] uint64_t count ( ) const { return total; }
+
+    [[nodiscard]] uint64_t max ( ) const { return maxValue; }
+
+    // value at quantile q in [0, 1], reported as the highest value equivalent to its bucket
+    [[nodiscard]] uint64_t percentile (double q) const
+    {
+        const auto target = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(total) + 0.5));
+        uint64_t   seen {0};
+        for ( size_t i = 0; i < BUCKETS; i++ ) {
+            seen += counts[i];
+            if ( seen >= target )
+                return std::min(highest(i), maxValue);
+        }
+        return maxValue;
+    }
+};
+
+// waits for an open loop schedule slot: sleeps while far away, then yields, so the target is hit within a few microseconds
+inline void pace_until (std::chrono::steady_clock::time_point when)
+{
+    constexpr auto slack = std::chrono::microseconds {50};
+    if ( auto now = std::chrono::steady_clock::now( ); when - now > slack )
+        std::this_thread::sleep_until(when - slack);
+    while ( std::chrono::steady_clock::now( ) < when )
+        std::this_thread::yield( );
+}
@@ -0,0 +1,124 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <map>
+#include <mutex>
+#include <random>
+
+#include "mt_vault.benchmark.h"
+#include "mt_vault.harness.h"
+#include "mt_vault.perf.h"
+#include "my_vault.h"
+
+// Open loop tail latency under a mixed workload.
+// Every worker issues operations on a fixed schedule derived from the target rate, and latency is measured from the
+// intended start of an operation, not from the moment the worker got around to it. A stall (lock convoy on an element,
+// a long predicate scan) therefore shows up in the latency of every operation queued behind it, which a closed loop
+// benchmark hides (coordinated omission).
+// Load levels are given in percent of the saturation throughput, measured once per capacity and thread count.
+
+// 62% view, 12% allocate, 25% deallocate by index, 1% deallocate by predicate; keeps the vault about half full
+template<size_t S>
+void mixed_op (Vault<Data, S>& v, std::mt19937_64& rng, size_t worker, size_t n)
+{
+    const auto dice = rng( ) % 100;
+    if ( dice < 62 ) {
+        if ( auto view = v.view(rng( ) % S) )
+            view( ).field_1++;
+    } else if ( dice < 74 ) {
+        if ( auto [view, inserted] = v.allocate( ); inserted )
+            view( ).field_3.assign(fmt::format("{}_{}", worker, n));
+    } else if ( dice < 99 ) {
+        v.deallocate(rng( ) % S);
+    } else {
+        v.deallocate([] (const Data& d) { return d.field_3.starts_with("0_"); });
+    }
+}
+
+template<size_t S>
+void prefill (Vault<Data, S>& v)
+{
+    for ( size_t n = 0; n < S / 2; n++ )
+        if ( auto [view, inserted] = v.allocate( ); inserted )
+            view( ).field_3.assign(fmt::format("{}_{}", n % 8, n));
+}
+
+// closed loop throughput of the mix in ops/s, cached per capacity and thread count
+template<size_t S>
+double saturation_rate (ThreadPool& pool)
+{
+    static std::mutex                 guard;
+    static std::map<size_t, double>   cache;
+    std::unique_lock                  _ {guard};
+    if ( auto i = cache.find(pool.size( )); i != cache.end( ) )
+        return i->second;
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    prefill(*v);
+    std::atomic_size_t ops {0};
+    const auto         start = std::chrono::steady_clock::now( );
+    pool.run([&v, &ops, start] (size_t w) {
+        std::mt19937_64 rng {w};
+        size_t          n {0};
+        while ( std::chrono::steady_clock::now( ) - start < std::chrono::milliseconds {200} )
+            mixed_op(*v, rng, w, n++);
+        ops.fetch_add(n);
+    });
+    return cache[pool.size( )] = static_cast<double>(ops.load( )) / seconds_since(start);
+}
+
+template<size_t S>
+void latency_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr auto window = std::chrono::milliseconds {250};
+
+    const size_t threads = static_cast<size_t>(state.range(0));
+    const double load    = static_cast<double>(state.range(1)) / 100.0;
+
+    ThreadPool   pool {threads};
+    const double saturation = saturation_rate<S>(pool);
+    const double perThread  = saturation * load / static_cast<double>(threads);
+    const auto   interval   = std::chrono::duration<double> {1.0 / perThread};
+    const auto   ops        = std::max<size_t>(1, static_cast<size_t>(perThread * std::chrono::duration<double> {window}.count( )));
+
+    auto v = std::make_unique<Vault<Data, S>>( );
+    prefill(*v);
+
+    std::vector<LatencyHistogram> histograms(threads);
+    double                        elapsed {0};
+    perf.start( );
+    for ( auto _: state ) {
+        const auto start = std::chrono::steady_clock::now( ) + std::chrono::milliseconds {1};
+        pool.run([&] (size_t w) {
+            std::mt19937_64 rng {w + 1};
+            for ( size_t k = 0; k < ops; k++ ) {
+                const auto intended = start + std::chrono::duration_cast<std::chrono::nanoseconds>(interval * static_cast<double>(k));
+                pace_until(intended);
+                mixed_op(*v, rng, w, k);
+                histograms[w].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now( ) - intended).count( )));
+            }
+        });
+        elapsed += seconds_since(start);
+    }
+    perf.stop( );
+
+    LatencyHistogram all;
+    for ( const auto& h: histograms )
+        all.merge(h);
+
+    auto us                       = [] (uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    state.counters["target/s"]    = benchmark::Counter(saturation * load);
+    state.counters["achieved/s"]  = benchmark::Counter(static_cast<double>(all.count( )) / elapsed);
+    state.counters["p50_us"]      = us(all.percentile(0.5));
+    state.counters["p90_us"]      = us(all.percentile(0.9));
+    state.counters["p99_us"]      = us(all.percentile(0.99));
+    state.counters["p99.9_us"]    = us(all.percentile(0.999));
+    state.counters["p99.99_us"]   = us(all.percentile(0.9999));
+    state.counters["max_us"]      = us(all.max( ));
+    state.SetItemsProcessed(static_cast<int64_t>(all.count( )));
+}
+
+BENCHMARK(latency_benchmark<1024 * 16>)->Name("latency 16K")->ArgNames({"threads", "load%"})->ArgsProduct({{1, 4, 16}, {25, 50, 75, 90, 100, 110}})->Unit(benchmark::kMillisecond)->UseRealTime( );
+BENCHMARK(latency_benchmark<1024 * 64>)->Name("latency 64K")->ArgNames({"threads", "load%"})->ArgsProduct({{1, 4, 16}, {25, 50, 75, 90, 100, 110}})->Unit(benchmark::kMillisecond)->UseRealTime( );
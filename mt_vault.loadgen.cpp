@@ -0,0 +1,264 @@
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+#include <csignal>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string_view>
+
+#include "mt_vault.benchmark.h"
+#include "mt_vault.harness.h"
+#include "my_vault.h"
+#include "my_vault_metrics.h"
+
+// Long running load generator for soak tests. Runs a configurable operation mix against one vault and prints interval
+// statistics (throughput, latency percentiles, occupancy, free slot scan length) so degradation over hours shows up,
+// optionally as a CSV time series and as a Prometheus textfile refreshed every interval.
+
+struct Options {
+    size_t      threads {4};
+    double      duration {60};  // seconds, 0 runs until interrupted
+    double      interval {1};
+    double      rate {0};  // total ops/s, 0 is closed loop
+    size_t      capacity {1024 * 64};
+    size_t      payload {40};
+    Pinning     pinning {Pinning::none};
+    size_t      mix[4] {30, 50, 19, 1};  // allocate, view, deallocate by index, deallocate by predicate
+    std::string csv;
+    std::string prometheus;
+};
+
+std::atomic_bool interrupted {false};
+
+inline uint64_t payload_key (const Data& d)
+{
+    return static_cast<uint64_t>(d.field_1);
+}
+
+inline void payload_assign (Data& d, uint64_t k)
+{
+    d.field_1 = static_cast<int>(k);
+    d.field_3 = fmt::format("key_{}", k);
+}
+
+template<size_t N, bool TRIVIAL>
+uint64_t payload_key (const Payload<N, TRIVIAL>& p)
+{
+    return p.key( );
+}
+
+template<size_t N, bool TRIVIAL>
+void payload_assign (Payload<N, TRIVIAL>& p, uint64_t k)
+{
+    p.assign(k);
+}
+
+struct Worker {
+    std::mutex       access;  // only contended by the reporter once per interval
+    LatencyHistogram latency;
+    size_t           ops {0};
+};
+
+template<class P, size_t S>
+int run (const Options& o)
+{
+    auto                                 v = std::make_unique<Vault<P, S>>( );
+    std::vector<std::unique_ptr<Worker>> workers;
+    for ( size_t i = 0; i < o.threads; i++ )
+        workers.push_back(std::make_unique<Worker>( ));
+
+    const size_t total = o.mix[0] + o.mix[1] + o.mix[2] + o.mix[3];
+    const auto   start = std::chrono::steady_clock::now( );
+    const auto   step  = o.rate > 0 ? std::chrono::duration<double> {static_cast<double>(o.threads) / o.rate} : std::chrono::duration<double> {0};
+
+    ThreadPool pool {o.threads, o.pinning};
+    std::stop_source stop;
+    std::jthread     load {[&] {
+        pool.run([&] (size_t w) {
+            std::mt19937_64 rng {w + 1};
+            Worker&         me = *workers[w];
+            for ( size_t k = 0; !stop.stop_requested( ); k++ ) {
+                auto intended = std::chrono::steady_clock::now( );
+                if ( o.rate > 0 ) {
+                    intended = start + std::chrono::duration_cast<std::chrono::nanoseconds>(step * static_cast<double>(k));
+                    pace_until(intended);
+                }
+                const auto dice = rng( ) % total;
+                if ( dice < o.mix[0] ) {
+                    if ( auto [view, inserted] = v->allocate( ); inserted )
+                        payload_assign(view( ), rng( ) % S);
+                } else if ( dice < o.mix[0] + o.mix[1] ) {
+                    if ( auto view = v->view(rng( ) % S) )
+                        payload_assign(view( ), payload_key(view( )) + 1);
+                } else if ( dice < o.mix[0] + o.mix[1] + o.mix[2] ) {
+                    v->deallocate(rng( ) % S);
+                } else {
+                    const uint64_t key = rng( ) % S;
+                    v->deallocate([key] (const P& p) { return payload_key(p) == key; });
+                }
+                const auto       ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now( ) - intended).count( );
+                std::unique_lock _ {me.access};
+                me.latency.record(static_cast<uint64_t>(ns));
+                me.ops++;
+            }
+        });
+    }};
+
+    std::ofstream csv;
+    if ( !o.csv.empty( ) ) {
+        csv.open(o.csv, std::ios::trunc);
+        csv << "elapsed_s,ops,ops_per_s,p50_us,p99_us,p999_us,max_us,occupied,allocation_failures,scan_per_alloc,lock_waits\n";
+    }
+    fmt::print("{:>9} {:>12} {:>10} {:>10} {:>10} {:>10} {:>10} {:>9} {:>10}\n", "elapsed", "ops/s", "p50 us", "p99 us", "p99.9 us", "max us", "occupied", "failures", "scan/alloc");
+
+    auto   previous = v->stats( );
+    auto   last     = start;
+    size_t allOps {0};
+    for ( size_t tick = 1; !interrupted; tick++ ) {
+        const auto next = start + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double> {o.interval * static_cast<double>(tick)});
+        while ( !interrupted && std::chrono::steady_clock::now( ) < next )
+            std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(next - std::chrono::steady_clock::now( ), std::chrono::milliseconds {100}));
+
+        LatencyHistogram latency;
+        size_t           ops {0};
+        for ( auto& w: workers ) {
+            std::unique_lock _ {w->access};
+            latency.merge(w->latency);
+            ops += w->ops;
+            w->latency.reset( );
+            w->ops = 0;
+        }
+        const auto now     = std::chrono::steady_clock::now( );
+        const auto stats   = v->stats( );
+        const auto elapsed = std::chrono::duration<double>(now - start).count( );
+        const auto perSec  = static_cast<double>(ops) / std::chrono::duration<double>(now - last).count( );
+        const auto allocs  = stats.allocations - previous.allocations;
+        const auto scan    = allocs ? static_cast<double>(stats.scannedSlots - previous.scannedSlots) / static_cast<double>(allocs) : 0.0;
+        const auto fails   = stats.allocationFailures - previous.allocationFailures;
+        size_t     waits {0};
+        for ( size_t b = 0; b < stats.lockWaits.size( ); b++ )
+            waits += stats.lockWaits[b] - previous.lockWaits[b];
+        auto us = [] (uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+
+        fmt::print("{:>8.1f}s {:>12.0f} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f} {:>10} {:>9} {:>10.1f}\n", elapsed, perSec, us(latency.percentile(0.5)), us(latency.percentile(0.99)),
+            us(latency.percentile(0.999)), us(latency.max( )), stats.occupied, fails, scan);
+        if ( csv.is_open( ) ) {
+            csv << fmt::format("{:.3f},{},{:.0f},{:.3f},{:.3f},{:.3f},{:.3f},{},{},{:.2f},{}\n", elapsed, ops, perSec, us(latency.percentile(0.5)), us(latency.percentile(0.99)),
+                us(latency.percentile(0.999)), us(latency.max( )), stats.occupied, fails, scan, waits);
+            csv.flush( );
+        }
+        if ( !o.prometheus.empty( ) )
+            write_prometheus(*v, o.prometheus, "loadgen");
+
+        allOps += ops;
+        previous = stats;
+        last     = now;
+        if ( o.duration > 0 && elapsed >= o.duration )
+            break;
+    }
+
+    stop.request_stop( );
+    load.join( );
+    fmt::print("total {} ops in {:.1f}s\n", allOps, std::chrono::duration<double>(std::chrono::steady_clock::now( ) - start).count( ));
+    return 0;
+}
+
+template<class P>
+int run_capacity (const Options& o)
+{
+    switch ( o.capacity ) {
+        case 1024 * 16: return run<P, 1024 * 16>(o);
+        case 1024 * 64: return run<P, 1024 * 64>(o);
+        case 1024 * 1024: return run<P, 1024 * 1024>(o);
+    }
+    fmt::print(stderr, "unsupported capacity {}, use 16384, 65536 or 1048576\n", o.capacity);
+    return 1;
+}
+
+int run_payload (const Options& o)
+{
+    switch ( o.payload ) {
+        case 40: return run_capacity<Data>(o);
+        case 8: return run_capacity<Payload<8, true>>(o);
+        case 64: return run_capacity<Payload<64, true>>(o);
+        case 256: return run_capacity<Payload<256, true>>(o);
+        case 1024: return run_capacity<Payload<1024, true>>(o);
+        case 4096: return run_capacity<Payload<4096, true>>(o);
+    }
+    fmt::print(stderr, "unsupported payload size {}, use 40 (the Data struct), 8, 64, 256, 1024 or 4096\n", o.payload);
+    return 1;
+}
+
+void usage (const char* self)
+{
+    fmt::print(stderr,
+        "usage: {} [options]\n"
+        "  --threads=N         worker threads (4)\n"
+        "  --duration=SEC      run time, 0 until interrupted (60)\n"
+        "  --interval=SEC      statistics interval (1)\n"
+        "  --rate=OPS          total target ops/s, open loop with latency from scheduled time; 0 is closed loop (0)\n"
+        "  --mix=A:V:D:P       percent of allocate, view, deallocate by index, deallocate by predicate (30:50:19:1)\n"
+        "  --capacity=N        16384, 65536 or 1048576 slots (65536)\n"
+        "  --payload=BYTES     40 (Data struct), 8, 64, 256, 1024 or 4096 (40)\n"
+        "  --pinning=POLICY    none, compact, scatter, one_per_core or cross_socket (none)\n"
+        "  --csv=FILE          write interval statistics as CSV\n"
+        "  --prometheus=FILE   refresh vault metrics in Prometheus text format every interval\n",
+        self);
+}
+
+int main (int argc, char** argv)
+{
+    Options o;
+    for ( int i = 1; i < argc; i++ ) {
+        const std::string_view arg {argv[i]};
+        const auto             eq    = arg.find('=');
+        const auto             key   = arg.substr(0, eq);
+        const std::string      value = eq == std::string_view::npos ? std::string { } : std::string {arg.substr(eq + 1)};
+        try {
+            if ( key == "--threads" )
+                o.threads = std::stoul(value);
+            else if ( key == "--duration" )
+                o.duration = std::stod(value);
+            else if ( key == "--interval" )
+                o.interval = std::stod(value);
+            else if ( key == "--rate" )
+                o.rate = std::stod(value);
+            else if ( key == "--capacity" )
+                o.capacity = std::stoul(value);
+            else if ( key == "--payload" )
+                o.payload = std::stoul(value);
+            else if ( key == "--csv" )
+                o.csv = value;
+            else if ( key == "--prometheus" )
+                o.prometheus = value;
+            else if ( key == "--mix" ) {
+                if ( std::sscanf(value.c_str( ), "%zu:%zu:%zu:%zu", &o.mix[0], &o.mix[1], &o.mix[2], &o.mix[3]) != 4 || o.mix[0] + o.mix[1] + o.mix[2] + o.mix[3] == 0 )
+                    throw std::invalid_argument {"mix"};
+            } else if ( key == "--pinning" ) {
+                const std::array policies {Pinning::none, Pinning::compact, Pinning::scatter, Pinning::one_per_core, Pinning::cross_socket};
+                const auto       p = std::ranges::find_if(policies, [&value] (Pinning p) { return pinning_name(p) == value; });
+                if ( p == policies.end( ) )
+                    throw std::invalid_argument {"pinning"};
+                o.pinning = *p;
+            } else {
+                usage(argv[0]);
+                return key == "--help" ? 0 : 1;
+            }
+        } catch ( const std::exception& ) {
+            fmt::print(stderr, "bad value for {}\n", key);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( o.threads == 0 || o.interval <= 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::signal(SIGINT, [] (int) { interrupted = true; });
+    std::signal(SIGTERM, [] (int) { interrupted = true; });
+    fmt::print("{} threads, capacity {}, payload {}B, mix {}:{}:{}:{}, {}, {}\n", o.threads, o.capacity, o.payload, o.mix[0], o.mix[1], o.mix[2], o.mix[3],
+        o.rate > 0 ? fmt::format("open loop at {} ops/s", o.rate) : std::string {"closed loop"}, CpuTopology::system( ).describe( ));
+    return run_payload(o);
+}
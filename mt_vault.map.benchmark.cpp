@@ -0,0 +1,56 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <random>
+#include <utility>
+
+#include "mt_vault.baselines.h"
+#include "mt_vault.benchmark.h"
+#include "mt_vault.harness.h"
+#include "mt_vault.perf.h"
+#include "my_vault_map.h"
+
+// VaultMap against the Vault + std::unordered_map + mutex pattern it replaces, on a keyed mix over a key space of twice
+// the capacity, about half of it present: 80% find and touch the value, 10% upsert, 5% insert, 5% erase
+
+constexpr size_t mapSlots = 1024 * 16;
+
+template<class M>
+void keyed_mix_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t ops = 4096;
+    ThreadPool       pool {static_cast<size_t>(state.range(0))};
+    auto             m = std::make_unique<M>( );
+    for ( uint64_t k = 0; k < mapSlots * 2; k += 2 )
+        m->insert(k, Data { });
+
+    perf.start( );
+    for ( auto _: state ) {
+        pool.run([&m] (size_t w) {
+            std::mt19937_64 rng {w};
+            for ( size_t n = 0; n < ops; n++ ) {
+                const auto     dice = rng( ) % 20;
+                const uint64_t key  = rng( ) % (mapSlots * 2);
+                if ( dice < 16 ) {
+                    if ( auto v = m->find(key) )
+                        v( ).field_1++;
+                } else if ( dice < 18 ) {
+                    Data d;
+                    d.field_1 = static_cast<int>(n);
+                    m->upsert(key, std::move(d));
+                } else if ( dice < 19 ) {
+                    m->insert(key, Data { });
+                } else {
+                    m->erase(key);
+                }
+            }
+        });
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * ops * pool.size( )));
+}
+
+BENCHMARK(keyed_mix_benchmark<VaultMap<uint64_t, Data, mapSlots>>)->Name("keyed mix/vault_map")->ArgName("threads")->Arg(1)->Arg(4)->Arg(16)->Unit(benchmark::kMillisecond)->UseRealTime( );
+BENCHMARK(keyed_mix_benchmark<WrappedMapVault<uint64_t, Data, mapSlots>>)->Name("keyed mix/wrapped_map")->ArgName("threads")->Arg(1)->Arg(4)->Arg(16)->Unit(benchmark::kMillisecond)->UseRealTime( );
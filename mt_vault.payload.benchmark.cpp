@@ -0,0 +1,136 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <array>
+#include <random>
+#include <type_traits>
+
+#include "mt_vault.benchmark.h"
+#include "mt_vault.harness.h"
+#include "mt_vault.perf.h"
+#include "my_vault.h"
+
+// Payload size and triviality sweep: the same allocate / view / scan / iterate workloads for payloads from 8 bytes to
+// 4 KB, trivially copyable or not, so layout choices can be judged against real data shapes instead of the 40 byte Data.
+
+static_assert(sizeof(Payload<8, true>) == 8 && sizeof(Payload<4096, false>) == 4096);
+static_assert(std::is_trivially_copyable_v<Payload<64, true>> && !std::is_trivially_copyable_v<Payload<64, false>>);
+
+constexpr size_t payloadSlots = 1024 * 16;
+
+template<class P>
+using PayloadVault = Vault<P, payloadSlots>;
+
+template<class P>
+void fill (PayloadVault<P>& v, ThreadPool& pool)
+{
+    pool.run([&v, &pool] (size_t w) {
+        for ( size_t n = 0; n < payloadSlots / pool.size( ); n++ )
+            if ( auto [view, inserted] = v.allocate( ); inserted )
+                view( ).assign(w * payloadSlots + n);
+    });
+}
+
+template<class P>
+void payload_allocate (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    ThreadPool                       pool {static_cast<size_t>(state.range(0))};
+    std::unique_ptr<PayloadVault<P>> v;
+    perf.start( );
+    for ( auto _: state ) {
+        perf.pause( );
+        v = std::make_unique<PayloadVault<P>>( );
+        perf.resume( );
+        fill(*v, pool);
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * payloadSlots));
+}
+
+template<class P>
+void payload_view (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    constexpr size_t views = 4096;
+    ThreadPool       pool {static_cast<size_t>(state.range(0))};
+    auto             v = std::make_unique<PayloadVault<P>>( );
+    fill(*v, pool);
+    perf.start( );
+    for ( auto _: state ) {
+        pool.run([&v] (size_t w) {
+            std::mt19937_64 rng {w};
+            for ( size_t n = 0; n < views; n++ )
+                if ( auto view = v->view(rng( ) % payloadSlots) )
+                    view( ).assign(view( ).key( ) + 1);
+        });
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * views * pool.size( )));
+}
+
+// predicate that never matches: every worker sweeps and locks the whole vault
+template<class P>
+void payload_scan (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    ThreadPool pool {static_cast<size_t>(state.range(0))};
+    auto       v = std::make_unique<PayloadVault<P>>( );
+    fill(*v, pool);
+    perf.start( );
+    for ( auto _: state )
+        pool.run([&v] (size_t) { benchmark::DoNotOptimize(v->deallocate([] (const P& p) { return p.key( ) == ~uint64_t {0}; })); });
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * payloadSlots * pool.size( )));
+}
+
+template<class P>
+void payload_iterate (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    ThreadPool pool {static_cast<size_t>(state.range(0))};
+    auto       v = std::make_unique<PayloadVault<P>>( );
+    fill(*v, pool);
+    perf.start( );
+    for ( auto _: state ) {
+        pool.run([&v] (size_t) {
+            uint64_t sum {0};
+            for ( auto i = v->begin( ); i != v->end( ); ++i )
+                sum += (*i)( ).key( );
+            benchmark::DoNotOptimize(sum);
+        });
+    }
+    perf.stop( );
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * payloadSlots * pool.size( )));
+}
+
+template<size_t N, bool TRIVIAL>
+void register_payload ( )
+{
+    using P           = Payload<N, TRIVIAL>;
+    const auto prefix = fmt::format("payload {:>4}B {}", N, TRIVIAL ? "trivial" : "non-trivial");
+    using Fn          = void (*)(benchmark::State&);
+    const std::array<std::pair<const char*, Fn>, 4> workloads {{{"allocate", payload_allocate<P>}, {"view", payload_view<P>}, {"scan", payload_scan<P>}, {"iterate", payload_iterate<P>}}};
+    for ( auto [name, fn]: workloads )
+        benchmark::RegisterBenchmark(fmt::format("{}/{}", prefix, name).c_str( ), fn)->ArgName("threads")->Arg(1)->Arg(4)->Arg(16)->Unit(benchmark::kMillisecond)->UseRealTime( );
+}
+
+template<size_t N>
+void register_payload_size ( )
+{
+    register_payload<N, true>( );
+    register_payload<N, false>( );
+}
+
+const bool payload_registered = [] {
+    register_payload_size<8>( );
+    register_payload_size<64>( );
+    register_payload_size<256>( );
+    register_payload_size<1024>( );
+    register_payload_size<4096>( );
+    return true;
+}( );
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+constexpr uint64_t perf_cache_event (uint64_t id, uint64_t result)
+{
+    return id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+}
+
+// Hardware counters read through perf_event_open(2) around a benchmark loop.
+// Opt in with MT_VAULT_PERF=1. Counters are opened for the calling thread with inherit set, so threads it spawns
+// afterwards (a ThreadPool created after the counters) are included; threads that already exist are not. Enabling and
+// disabling reaches those threads as well.
+// When perf events are not permitted (perf_event_paranoid, seccomp, no PMU in a VM) every event is just skipped.
+class PerfCounters
+{
+public:
+    struct Event {
+        std::string_view name;
+        uint32_t         type;
+        uint64_t         config;
+    };
+
+    static constexpr std::array<Event, 6> EVENTS {{
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {"l1d_misses", PERF_TYPE_HW_CACHE, perf_cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        {"llc_misses", PERF_TYPE_HW_CACHE, perf_cache_event(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        {"dtlb_misses", PERF_TYPE_HW_CACHE, perf_cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    }};
+
+    using Values = std::array<double, EVENTS.size( )>;
+
+    static bool enabled ( )
+    {
+        static const bool on = [] {
+            const char* env = std::getenv("MT_VAULT_PERF");
+            return env && std::string_view {env} != "0";
+        }( );
+        return on;
+    }
+
+    PerfCounters( )
+    {
+        if ( !enabled( ) )
+            return;
+        for ( size_t i = 0; i < EVENTS.size( ); i++ ) {
+            perf_event_attr attr { };
+            attr.size           = sizeof(attr);
+            attr.type           = EVENTS[i].type;
+            attr.config         = EVENTS[i].config;
+            attr.disabled       = 1;
+            attr.inherit        = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fd[i]               = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if ( fd[i] < 0 )
+                warnOnce(EVENTS[i].name, errno);
+        }
+    }
+
+    PerfCounters(const PerfCounters&)            = delete;
+    PerfCounters& operator= (const PerfCounters&) = delete;
+
+    ~PerfCounters( )
+    {
+        for ( int f: fd )
+            if ( f >= 0 )
+                close(f);
+    }
+
+    [[nodiscard]] bool available ( ) const
+    {
+        return std::ranges::any_of(fd, [] (int f) { return f >= 0; });
+    }
+
+    // counts add up over every start() / stop() span since opening
+    void start ( )
+    {
+        for ( int f: fd )
+            if ( f >= 0 )
+                ioctl(f, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    void stop ( )
+    {
+        for ( int f: fd )
+            if ( f >= 0 )
+                ioctl(f, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    // counter values so far, scaled up when the PMU had to multiplex events; -1 for unavailable events
+    [[nodiscard]] Values read ( ) const
+    {
+        Values v;
+        v.fill(-1);
+        for ( size_t i = 0; i < EVENTS.size( ); i++ ) {
+            uint64_t buf[3] { };
+            if ( fd[i] < 0 || ::read(fd[i], buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0 )
+                continue;
+            v[i] = static_cast<double>(buf[0]) * static_cast<double>(buf[1]) / static_cast<double>(buf[2]);
+        }
+        return v;
+    }
+
+    // publishes each available event as "<event>/op" averaged over ops operations
+    static void publish (benchmark::State& state, const Values& values, double ops)
+    {
+        if ( ops <= 0 )
+            return;
+        for ( size_t i = 0; i < EVENTS.size( ); i++ )
+            if ( values[i] >= 0 )
+                state.counters[fmt::format("{}/op", EVENTS[i].name)] = values[i] / ops;
+    }
+
+    void publish (benchmark::State& state, double ops) const { publish(state, read( ), ops); }
+
+private:
+    std::array<int, EVENTS.size( )> fd {-1, -1, -1, -1, -1, -1};
+
+    static void warnOnce (std::string_view event, int err)
+    {
+        static std::atomic_flag warned;
+        if ( !warned.test_and_set( ) )
+            fmt::print(stderr, "perf counter '{}' unavailable ({}), continuing without it\n", event, std::strerror(err));
+    }
+};
+
+// What every benchmark uses: the counters of one benchmark run, declared first in the benchmark function so that its
+// threads are created after them. start() and stop() go right before and after the loop, pause() and resume() take the
+// place of state.PauseTiming() and ResumeTiming(), so set up work is left out of the counts like it is from the timing.
+// Leaving the scope publishes the counts per processed item, per iteration when there are none.
+class PerfScope
+{
+public:
+    explicit PerfScope(benchmark::State& s) : state {s} { }
+
+    PerfScope(const PerfScope&)            = delete;
+    PerfScope& operator= (const PerfScope&) = delete;
+
+    ~PerfScope( )
+    {
+        counters.stop( );
+        const int64_t items = state.items_processed( );
+        counters.publish(state, static_cast<double>(items > 0 ? items : static_cast<int64_t>(state.iterations( ))));
+    }
+
+    void start ( ) { counters.start( ); }
+
+    void stop ( ) { counters.stop( ); }
+
+    void pause ( )
+    {
+        counters.stop( );
+        state.PauseTiming( );
+    }
+
+    void resume ( )
+    {
+        state.ResumeTiming( );
+        counters.start( );
+    }
+
+private:
+    benchmark::State& state;
+    PerfCounters      counters;
+};
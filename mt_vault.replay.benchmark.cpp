@@ -0,0 +1,155 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <cstdlib>
+#include <map>
+
+#include "mt_vault.benchmark.h"
+#include "mt_vault.harness.h"
+#include "mt_vault.perf.h"
+#include "my_vault.h"
+#include "my_vault_trace.h"
+
+// Deterministic replay of a trace captured with Vault::start_trace().
+// Set MT_VAULT_TRACE=<file> to register the benchmark. Every traced thread is replayed by its own pool worker, in its
+// original order; speedup:1 keeps the original timing, speedup:N compresses it N times and speedup:0 replays as fast as
+// possible. With timing on, latency is measured from the scheduled time of an operation, as in the latency benchmark.
+// Slots handed out by the replay vault may differ from the traced ones, so traced indices are translated through the
+// slots the replayed allocations actually got. Predicates are not traced: a successful predicate deallocation is
+// replayed as deallocation of the slot it freed, a failed one as a full scan with a predicate that never matches.
+// Records of TraceRecord::SHARED_THREAD, from threads beyond the 16 bit ids, are replayed by one worker as if they came
+// from a single thread; the shared_records counter tells how many there were.
+// The vault is instantiated for a few capacities only: a trace is replayed on the smallest that holds its capacity,
+// named in the benchmark and reported by the capacity and traced_capacity counters when it is larger.
+
+struct Trace {
+    TraceHeader                           header;
+    std::vector<std::vector<TraceRecord>> threads;
+    size_t                                records {0};
+    size_t                                shared {0};  // records of TraceRecord::SHARED_THREAD
+};
+
+const Trace& replay_trace ( )
+{
+    static const Trace trace = [] {
+        Trace t;
+        if ( const char* path = std::getenv("MT_VAULT_TRACE") ) {
+            std::map<uint16_t, size_t> dense;
+            for ( const auto& r: read_trace(path, &t.header) ) {
+                auto [i, added] = dense.emplace(r.thread, dense.size( ));
+                if ( added )
+                    t.threads.emplace_back( );
+                t.threads[i->second].push_back(r);
+                t.records++;
+                t.shared += r.thread == TraceRecord::SHARED_THREAD;
+            }
+        }
+        return t;
+    }( );
+    return trace;
+}
+
+template<size_t S>
+void replay_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    const Trace& trace   = replay_trace( );
+    const auto   speedup = static_cast<double>(state.range(0));
+
+    ThreadPool                             pool {trace.threads.size( )};
+    std::unique_ptr<Vault<Data, S>>        v;
+    std::vector<std::atomic_size_t>        slot(S + 1);
+    std::vector<LatencyHistogram>          histograms(pool.size( ));
+    std::atomic_size_t                     divergent {0};
+    std::chrono::steady_clock::time_point  start;
+
+    auto target = [&slot] (uint32_t idx) { return slot[std::min<size_t>(idx, S)].load(std::memory_order_relaxed); };
+
+    const ThreadPool::Task replay = [&] (size_t w) {
+        for ( const auto& r: trace.threads[w] ) {
+            const auto intended = speedup > 0 ? start + std::chrono::nanoseconds {static_cast<int64_t>(static_cast<double>(r.ns) / speedup)} : std::chrono::steady_clock::now( );
+            if ( speedup > 0 )
+                pace_until(intended);
+            bool ok {false};
+            switch ( r.op ) {
+                case TraceOp::allocate:
+                    if ( auto [view, inserted] = v->allocate( ); inserted ) {
+                        view( ).field_3.assign(fmt::format("{}_{}", w, r.index));
+                        if ( r.ok )
+                            slot[r.index].store(view.index( ), std::memory_order_relaxed);
+                        ok = true;
+                    }
+                    break;
+                case TraceOp::view:
+                    if ( auto view = v->view(std::min(target(r.index), S - 1)) ) {
+                        view( ).field_1++;
+                        ok = true;
+                    }
+                    break;
+                case TraceOp::deallocate: ok = target(r.index) < S && v->deallocate(target(r.index)); break;
+                case TraceOp::deallocate_pred:
+                    if ( r.ok )
+                        ok = target(r.index) < S && v->deallocate(target(r.index));
+                    else
+                        ok = v->deallocate([] (const Data&) { return false; });
+                    break;
+            }
+            if ( ok != static_cast<bool>(r.ok) )
+                divergent.fetch_add(1, std::memory_order_relaxed);
+            histograms[w].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now( ) - intended).count( )));
+        }
+    };
+
+    perf.start( );
+    for ( auto _: state ) {
+        perf.pause( );
+        v = std::make_unique<Vault<Data, S>>( );
+        for ( size_t i = 0; i <= S; i++ )
+            slot[i].store(i);
+        perf.resume( );
+        start = std::chrono::steady_clock::now( ) + std::chrono::milliseconds {1};
+        pool.run(replay);
+    }
+    perf.stop( );
+
+    LatencyHistogram all;
+    for ( const auto& h: histograms )
+        all.merge(h);
+    auto us                           = [] (uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    state.counters["threads"]         = static_cast<double>(pool.size( ));
+    state.counters["divergent"]       = static_cast<double>(divergent.load( )) / static_cast<double>(state.iterations( ));
+    state.counters["shared_records"]  = static_cast<double>(trace.shared);
+    state.counters["capacity"]        = static_cast<double>(S);
+    state.counters["traced_capacity"] = static_cast<double>(trace.header.capacity);
+    state.counters["p50_us"]          = us(all.percentile(0.5));
+    state.counters["p99_us"]          = us(all.percentile(0.99));
+    state.counters["p99.9_us"]        = us(all.percentile(0.999));
+    state.counters["max_us"]          = us(all.max( ));
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * trace.records));
+}
+
+template<size_t S>
+bool register_replay (size_t capacity)
+{
+    if ( capacity > S )
+        return false;
+    const auto name = capacity == S ? fmt::format("replay {}", std::getenv("MT_VAULT_TRACE")) : fmt::format("replay {} on {} slots (traced {})", std::getenv("MT_VAULT_TRACE"), S, capacity);
+    benchmark::RegisterBenchmark(name.c_str( ), replay_benchmark<S>)
+        ->ArgName("speedup")
+        ->Arg(1)
+        ->Arg(10)
+        ->Arg(0)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime( );
+    return true;
+}
+
+const bool replay_registered = [] {
+    const auto& trace = replay_trace( );
+    if ( trace.records == 0 )
+        return false;
+    const auto capacity = trace.header.capacity;
+    return register_replay<1024>(capacity) || register_replay<1024 * 16>(capacity) || register_replay<1024 * 64>(capacity) || register_replay<1024 * 1024>(capacity)
+        || register_replay<1024 * 1024 * 16>(capacity);
+}( );
@@ -0,0 +1,154 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+#include <sys/mman.h>
+
+#include <memory>
+#include <new>
+#include <string_view>
+
+#include "mt_vault.benchmark.h"
+#include "mt_vault.perf.h"
+#include "my_vault.h"
+
+// Startup cost of a vault: construction, first sweep over the fresh storage and destruction, each timed on its own.
+// Baseline for lazy commit / runtime sized storage work, so every phase is run for every way the vault object may be placed.
+// With MT_VAULT_PERF=1 the hardware counters cover the timed phase only.
+
+// make_unique<Vault>() value-initializes, i.e. zero fills the whole object before running member initializers
+struct HeapBackend {
+    static constexpr std::string_view name {"heap"};
+
+    template<class V>
+    static V* create ( )
+    {
+        return std::make_unique<V>( ).release( );
+    }
+
+    template<class V>
+    static void destroy (V* v)
+    {
+        delete v;
+    }
+};
+
+// default-initialization skips the zero fill
+struct HeapForOverwriteBackend {
+    static constexpr std::string_view name {"heap_for_overwrite"};
+
+    template<class V>
+    static V* create ( )
+    {
+        return std::make_unique_for_overwrite<V>( ).release( );
+    }
+
+    template<class V>
+    static void destroy (V* v)
+    {
+        delete v;
+    }
+};
+
+// private anonymous mapping, pages are committed by the constructor touching them
+template<bool HUGE_PAGES>
+struct MmapBackend {
+    static constexpr std::string_view name {HUGE_PAGES ? "mmap_thp" : "mmap"};
+
+    template<class V>
+    static V* create ( )
+    {
+        void* p = mmap(nullptr, sizeof(V), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if ( p == MAP_FAILED )
+            throw std::bad_alloc { };
+        if constexpr ( HUGE_PAGES )
+            madvise(p, sizeof(V), MADV_HUGEPAGE);
+        return new (p) V;
+    }
+
+    template<class V>
+    static void destroy (V* v)
+    {
+        v->~V( );
+        munmap(v, sizeof(V));
+    }
+};
+
+template<size_t S, class Backend>
+void construct_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    size_t rss {0};
+    for ( auto _: state ) {
+        perf.start( );
+        const auto start = std::chrono::steady_clock::now( );
+        auto*      v     = Backend::template create<Vault<Data, S>>( );
+        benchmark::DoNotOptimize(v);
+        state.SetIterationTime(seconds_since(start));
+        perf.stop( );
+        rss = resident_bytes(v, sizeof(*v));
+        Backend::destroy(v);
+    }
+    state.counters["rss"]           = benchmark::Counter(static_cast<double>(rss), benchmark::Counter::kDefaults, benchmark::Counter::kIs1024);
+    state.counters["rss_per_slot"]  = static_cast<double>(rss) / S;
+    state.counters["size_per_slot"] = static_cast<double>(sizeof(Vault<Data, S>)) / S;
+}
+
+template<size_t S, class Backend>
+void first_touch_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    for ( auto _: state ) {
+        auto* v = Backend::template create<Vault<Data, S>>( );
+        perf.start( );
+        const auto start = std::chrono::steady_clock::now( );
+        for ( size_t idx = 0; idx < S; idx++ )
+            benchmark::DoNotOptimize(static_cast<bool>(v->view(idx)));
+        state.SetIterationTime(seconds_since(start));
+        perf.stop( );
+        Backend::destroy(v);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations( ) * S));
+}
+
+template<size_t S, class Backend>
+void destroy_benchmark (benchmark::State& state)
+{
+    PerfScope perf {state};
+
+    for ( auto _: state ) {
+        auto* v = Backend::template create<Vault<Data, S>>( );
+        perf.start( );
+        const auto start = std::chrono::steady_clock::now( );
+        Backend::destroy(v);
+        state.SetIterationTime(seconds_since(start));
+        perf.stop( );
+    }
+}
+
+template<size_t S, class Backend>
+void register_startup ( )
+{
+    const auto suffix = S >= 1024 * 1024 ? fmt::format("{:>3}M/{}", S / 1024 / 1024, Backend::name) : fmt::format("{:>3}K/{}", S / 1024, Backend::name);
+    benchmark::RegisterBenchmark(fmt::format("construct   {}", suffix).c_str( ), construct_benchmark<S, Backend>)->Unit(benchmark::kMillisecond)->UseManualTime( );
+    benchmark::RegisterBenchmark(fmt::format("first touch {}", suffix).c_str( ), first_touch_benchmark<S, Backend>)->Unit(benchmark::kMillisecond)->UseManualTime( );
+    benchmark::RegisterBenchmark(fmt::format("destroy     {}", suffix).c_str( ), destroy_benchmark<S, Backend>)->Unit(benchmark::kMillisecond)->UseManualTime( );
+}
+
+template<class Backend>
+void register_startup_sizes ( )
+{
+    register_startup<1024, Backend>( );
+    register_startup<1024 * 16, Backend>( );
+    register_startup<1024 * 256, Backend>( );
+    register_startup<1024 * 1024 * 4, Backend>( );
+    register_startup<1024 * 1024 * 16, Backend>( );
+}
+
+const bool startup_registered = [] {
+    register_startup_sizes<HeapBackend>( );
+    register_startup_sizes<HeapForOverwriteBackend>( );
+    register_startup_sizes<MmapBackend<false>>( );
+    register_startup_sizes<MmapBackend<true>>( );
+    return true;
+}( );
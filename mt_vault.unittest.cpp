@@ -3,9 +3,16 @@
 #include <gtest/gtest.h>
 
 #include <random>
+#include <set>
+#include <span>
 #include <thread>
 
 #include "my_vault.h"
+#include "my_vault_keyed.h"
+#include "my_vault_map.h"
+#include "my_vault_metrics.h"
+#include "my_vault_percpu.h"
+#include "my_vault_tenants.h"
 
 struct Data {
     int         field_1 {0};
@@ -346,3 +353,1014 @@ TEST(mt_vault, wild)
     for ( auto& t: thr )
         t.join( );
 }
+
+TEST(mt_vault, metrics)
+{
+    auto                                   v = std::make_unique<Vault<Data, maxElementNumber>>( );
+    std::array<std::jthread, threadsCount> thr;
+
+    for ( size_t i = 0; i < threadsCount; i++ ) {
+        thr[i] = std::jthread([i, &v] ( ) {
+            for ( size_t n = 0; n < maxElementNumber / threadsCount; n++ ) {
+                if ( auto [view, inserted] = v->allocate( ); inserted )
+                    view( ).field_3.assign(fmt::format("{}_{}", i + 1, n + 1));
+            }
+        });
+    }
+    for ( auto& t: thr )
+        t.join( );
+
+    EXPECT_FALSE(v->allocate( ).second);
+    for ( size_t idx = 0; idx < maxElementNumber; idx += 2 )
+        v->deallocate(idx);
+    EXPECT_FALSE(v->deallocate(0));
+    v->view(1);
+
+    const auto stats = v->stats( );
+    EXPECT_EQ(stats.capacity, maxElementNumber);
+    EXPECT_EQ(stats.occupied, maxElementNumber / 2);
+    EXPECT_EQ(stats.allocations, maxElementNumber);
+    EXPECT_EQ(stats.allocationFailures, 1);
+    EXPECT_EQ(stats.deallocations, maxElementNumber / 2);
+    EXPECT_EQ(stats.deallocationMisses, 1);
+    EXPECT_EQ(stats.views, 1);
+    EXPECT_GE(stats.scannedSlots, stats.allocations);  // the full vault refused the last allocation without a scan
+    EXPECT_GE(stats.memoryBytes, sizeof(Data) * maxElementNumber);
+
+    const auto text = prometheus_text(*v, "test");
+    EXPECT_NE(text.find(fmt::format("mt_vault_occupied{{vault=\"test\"}} {}\n", maxElementNumber / 2)), std::string::npos);
+    EXPECT_NE(text.find("# TYPE mt_vault_lock_wait_seconds histogram\n"), std::string::npos);
+    EXPECT_NE(text.find("mt_vault_lock_wait_seconds_bucket{vault=\"test\",le=\"+Inf\"}"), std::string::npos);
+}
+
+TEST(mt_vault, trace)
+{
+    constexpr size_t threads {8};
+    const std::string path {testing::TempDir( ) + "mt_vault.trace"};
+
+    auto                              v = std::make_unique<Vault<Data, 1024>>( );
+    std::array<std::jthread, threads> thr;
+
+    v->allocate( );  // not traced
+    ASSERT_TRUE(v->start_trace(path));
+    for ( size_t i = 0; i < threads; i++ ) {
+        thr[i] = std::jthread([i, &v] ( ) {
+            for ( size_t n = 0; n < v->capacity( ) / threads; n++ ) {
+                if ( auto [view, inserted] = v->allocate( ); inserted )
+                    view( ).field_3.assign(fmt::format("{}_{}", i + 1, n + 1));
+            }
+        });
+    }
+    for ( auto& t: thr )
+        t.join( );
+    // enough records to go through several chunk flushes
+    for ( size_t i = 0; i < threads; i++ ) {
+        thr[i] = std::jthread([&v] ( ) {
+            for ( size_t n = 0; n < TraceRecorder::CHUNK / 2; n++ )
+                v->view(n % v->capacity( ));
+        });
+    }
+    for ( auto& t: thr )
+        t.join( );
+    v->deallocate(0);
+    v->deallocate(0);
+    v->view(1);
+    v->deallocate([] (const Data& d) { return d.field_3 == "1_1"; });
+    v->stop_trace( );
+    v->deallocate(2);  // not traced
+
+    TraceHeader header;
+    const auto  records = read_trace(path, &header);
+    EXPECT_EQ(header.capacity, v->capacity( ));
+    ASSERT_EQ(records.size( ), v->capacity( ) + threads * TraceRecorder::CHUNK / 2 + 4);
+    EXPECT_EQ(std::ranges::count_if(records, [] (const TraceRecord& r) { return r.op == TraceOp::view; }), threads * TraceRecorder::CHUNK / 2 + 1);
+    EXPECT_EQ(std::ranges::count_if(records, [] (const TraceRecord& r) { return r.op == TraceOp::allocate && r.ok; }), v->capacity( ) - 1);
+    EXPECT_EQ(std::ranges::count_if(records, [] (const TraceRecord& r) { return r.op == TraceOp::allocate && !r.ok && r.index == 1024; }), 1);
+    std::set<uint16_t> threadIds;
+    for ( const auto& r: records )
+        threadIds.insert(r.thread);
+    EXPECT_EQ(threadIds.size( ), 2 * threads + 1);
+
+    const auto& tail = std::span {records}.last(4);
+    EXPECT_TRUE(tail[0].op == TraceOp::deallocate && tail[0].index == 0 && tail[0].ok);
+    EXPECT_TRUE(tail[1].op == TraceOp::deallocate && tail[1].index == 0 && !tail[1].ok);
+    EXPECT_TRUE(tail[2].op == TraceOp::view && tail[2].index == 1 && tail[2].ok);
+    EXPECT_TRUE(tail[3].op == TraceOp::deallocate_pred && tail[3].ok);
+    EXPECT_LE(tail[0].ns, tail[3].ns);
+    std::remove(path.c_str( ));
+}
+
+TEST(mt_vault, keyed)
+{
+    constexpr size_t slots {1024 * 4};
+    constexpr size_t threads {16};
+    constexpr size_t perThread {slots / threads};
+
+    auto key = [] (const Data& d) { return d.field_1; };
+    auto v   = std::make_unique<KeyedVault<Data, slots, decltype(key)>>( );
+
+    // every thread owns a key range: a key it published must be found until it removes it, whatever the others do
+    std::array<std::jthread, threads> thr;
+    for ( size_t i = 0; i < threads; i++ ) {
+        thr[i] = std::jthread([i, &v] ( ) {
+            const int base = static_cast<int>(i * perThread) + 1;
+            for ( int n = 0; n < static_cast<int>(perThread); n++ ) {
+                auto [view, inserted] = v->allocate( );
+                ASSERT_TRUE(inserted);
+                view( ).field_1 = base + n;
+            }
+            for ( int n = 0; n < static_cast<int>(perThread); n += 2 ) {
+                ASSERT_TRUE(v->contains(base + n));
+                ASSERT_TRUE(v->deallocate_by_key(base + n));
+            }
+        });
+    }
+    for ( auto& t: thr )
+        t.join( );
+
+    EXPECT_EQ(v->stats( ).occupied, slots / 2);
+    EXPECT_TRUE(v->contains(2));
+    EXPECT_FALSE(v->deallocate_by_key(1));
+
+    // a key changed through a view is found under the new key only
+    size_t idx {0};
+    while ( !v->view(idx) )
+        idx++;
+    v->view(idx)( ).field_1 = -5;
+    EXPECT_TRUE(v->contains(-5));
+    EXPECT_TRUE(v->deallocate(idx));
+    EXPECT_FALSE(v->contains(-5));
+
+    const auto before = v->filter_stats( );
+    for ( int k = 0; k < 1000; k++ )
+        EXPECT_FALSE(v->deallocate_by_key(-1000 - k));
+    const auto after = v->filter_stats( );
+    EXPECT_EQ(after.lookups - before.lookups, 1000);
+    EXPECT_GT(after.rejects - before.rejects, 900);
+    EXPECT_EQ(after.rejects - before.rejects + after.falsePositives - before.falsePositives, 1000);
+}
+
+TEST(mt_vault, find_first)
+{
+    auto v = std::make_unique<Vault<Data, maxElementNumber>>( );
+    for ( size_t n = 0; n < maxElementNumber; n++ ) {
+        auto [view, inserted] = v->allocate( );
+        ASSERT_TRUE(inserted);
+        view( ).field_1 = static_cast<int>(view.index( ));
+    }
+
+    auto late = [] (const Data& d) { return d.field_1 >= 40000 && d.field_1 % 1000 == 999; };
+    EXPECT_EQ(v->find_first(late, 8).index( ), 40999);
+    EXPECT_EQ(v->find_first(late, 1).index( ), 40999);
+    EXPECT_TRUE(v->deallocate_first(late, 8));
+    EXPECT_EQ(v->find_first(late, 8).index( ), 41999);
+    EXPECT_FALSE(v->find_first([] (const Data&) { return false; }, 8));
+    EXPECT_FALSE(v->deallocate_first([] (const Data& d) { return d.field_1 < 0; }, 8));
+
+    // a throwing predicate stops the search, reaches the caller and leaves nothing locked
+    auto throwing = [] (const Data& d) {
+        if ( d.field_1 == 30000 )
+            throw std::runtime_error {"bad element"};
+        return false;
+    };
+    EXPECT_THROW(v->find_first(throwing, 8), std::runtime_error);
+    EXPECT_THROW(v->find_first(throwing, 1), std::runtime_error);
+    EXPECT_EQ(v->find_first(late, 8).index( ), 41999);
+    EXPECT_TRUE(v->view(30000));
+
+    // concurrent callers take every match exactly once
+    constexpr size_t                  threads {8};
+    std::atomic_size_t                taken {0};
+    std::array<std::jthread, threads> thr;
+    for ( auto& t: thr ) {
+        t = std::jthread([&v, &taken] ( ) {
+            while ( v->deallocate_first([] (const Data& d) { return d.field_1 >= static_cast<int>(maxElementNumber - 64); }, 4) )
+                taken++;
+        });
+    }
+    for ( auto& t: thr )
+        t.join( );
+    EXPECT_EQ(taken.load( ), 64);
+    EXPECT_EQ(v->stats( ).occupied, maxElementNumber - 64 - 1);
+}
+
+TEST(mt_vault, consume)
+{
+    constexpr size_t producers {4};
+    constexpr size_t consumers {4};
+    constexpr size_t items {2048};
+
+    auto v = std::make_unique<Vault<Data, 1024>>( );
+    EXPECT_FALSE(v->try_consume([] (Data&) { }));
+
+    std::mutex         guard;
+    std::set<int>      seen;
+    std::atomic_size_t consumed {0};
+    std::stop_source   stop;
+
+    std::array<std::jthread, consumers> cons;
+    for ( auto& t: cons ) {
+        t = std::jthread([&] ( ) {
+            while ( v->consume_wait(
+                [&] (Data& d) {
+                    std::unique_lock _ {guard};
+                    EXPECT_TRUE(seen.insert(d.field_1).second);
+                    EXPECT_EQ(d.field_3, fmt::format("item_{}", d.field_1));
+                },
+                stop.get_token( )) )
+                consumed++;
+        });
+    }
+    // more items than slots: producers have to wait for consumers to make room
+    std::array<std::jthread, producers> prod;
+    for ( size_t i = 0; i < producers; i++ ) {
+        prod[i] = std::jthread([i, &v] ( ) {
+            for ( size_t n = i; n < items; n += producers ) {
+                auto [view, inserted] = v->allocate( );
+                for ( ; !inserted; std::tie(view, inserted) = v->allocate( ) )
+                    std::this_thread::yield( );
+                view( ).field_1 = static_cast<int>(n);
+                view( ).field_3 = fmt::format("item_{}", n);
+            }
+        });
+    }
+    for ( auto& t: prod )
+        t.join( );
+    while ( consumed.load( ) < items )
+        std::this_thread::sleep_for(1ms);
+    stop.request_stop( );
+    for ( auto& t: cons )
+        t.join( );
+
+    EXPECT_EQ(seen.size( ), items);
+    EXPECT_EQ(v->stats( ).occupied, 0);
+    EXPECT_FALSE(v->try_consume([] (Data&) { }));
+}
+
+TEST(mt_vault, tags)
+{
+    constexpr size_t slots {1024 * 4};
+    constexpr size_t threads {8};
+    constexpr size_t groups {4};
+
+    auto                              v = std::make_unique<Vault<Data, slots, groups>>( );
+    std::array<std::jthread, threads> thr;
+    for ( size_t i = 0; i < threads; i++ ) {
+        thr[i] = std::jthread([i, &v] ( ) {
+            for ( size_t n = 0; n < slots / threads; n++ ) {
+                if ( auto [view, inserted] = v->allocate( ); inserted ) {
+                    view( ).field_3.assign(fmt::format("{}_{}", i % groups, n));
+                    view.tag(i % groups);
+                }
+            }
+        });
+    }
+    for ( auto& t: thr )
+        t.join( );
+
+    for ( size_t g = 0; g < groups; g++ ) {
+        size_t n {0};
+        v->for_each_tagged(g, [g, &n] (auto& view) {
+            EXPECT_TRUE(view( ).field_3.starts_with(fmt::format("{}_", g)));
+            n++;
+        });
+        EXPECT_EQ(n, slots / groups);
+        EXPECT_EQ(v->count_tagged(g), slots / groups);
+    }
+
+    // untagging through a view; slot 0 was the first allocation of its thread, so it holds "<group>_0"
+    size_t first {0};
+    {
+        auto view = v->view(0);
+        while ( !view.tagged(first) )
+            first++;
+        view.tag(first, false);
+        EXPECT_FALSE(view.tagged(first));
+    }
+    EXPECT_EQ(v->count_tagged(0) + v->count_tagged(1) + v->count_tagged(2) + v->count_tagged(3), slots - 1);
+
+    // tagged bulk removal with and without predicate; every thread wrote 0..511, 52 of them ending in 0
+    const size_t withZero = 2 * 52 - (first == 2);
+    const size_t all      = slots / groups - (first == 3);
+    EXPECT_EQ(v->deallocate_tagged(2, [] (const Data& d) { return d.field_3.ends_with("0"); }), withZero);
+    EXPECT_EQ(v->deallocate_tagged(3), all);
+    EXPECT_EQ(v->count_tagged(3), 0);
+    EXPECT_EQ(v->stats( ).occupied, slots - withZero - all);
+
+    // a reused slot starts without tags
+    auto [view, inserted] = v->allocate( );
+    ASSERT_TRUE(inserted);
+    for ( size_t g = 0; g < groups; g++ )
+        EXPECT_FALSE(view.tagged(g));
+    EXPECT_THROW(view.tag(groups), std::out_of_range);
+}
+
+TEST(mt_vault, rank_select)
+{
+    constexpr size_t slots {1024 * 4};
+
+    auto v = std::make_unique<Vault<Data, slots>>( );
+    for ( size_t n = 0; n < slots; n++ )
+        v->allocate( ).first( ).field_1 = static_cast<int>(n);
+    for ( size_t idx = 0; idx < slots; idx += 3 )
+        v->deallocate(idx);
+
+    std::vector<size_t> occupied;
+    for ( size_t idx = 0; idx < slots; idx++ )
+        if ( idx % 3 != 0 )
+            occupied.push_back(idx);
+    for ( size_t k = 0; k < occupied.size( ); k += 7 )
+        EXPECT_EQ(v->nth_occupied(k).index( ), occupied[k]);
+    EXPECT_FALSE(v->nth_occupied(occupied.size( )));
+
+    // the directory follows later changes
+    v->deallocate(occupied.front( ));
+    EXPECT_EQ(v->nth_occupied(0).index( ), occupied[1]);
+    EXPECT_EQ(v->nth_occupied(occupied.size( ) - 2).index( ), occupied.back( ));
+
+    std::mt19937_64 rng {7};
+    const auto      picked = v->sample(100, rng);
+    ASSERT_EQ(picked.size( ), 100);
+    EXPECT_TRUE(std::ranges::is_sorted(picked));
+    EXPECT_EQ(std::ranges::adjacent_find(picked), picked.end( ));
+    for ( size_t idx: picked )
+        EXPECT_TRUE(v->view(idx));
+    EXPECT_EQ(v->sample(slots, rng).size( ), occupied.size( ) - 1);
+
+    // roughly uniform: every quarter of the index space gets its share of many samples
+    std::array<size_t, 4> quarters { };
+    for ( size_t round = 0; round < 200; round++ )
+        for ( size_t idx: v->sample(20, rng) )
+            quarters[idx * 4 / slots]++;
+    for ( size_t q: quarters )
+        EXPECT_NEAR(static_cast<double>(q), 1000.0, 150.0);
+
+    // churn keeps at most one slot per thread free at a time, so ranks below that never come back empty
+    constexpr size_t churners {2};
+
+    auto w = std::make_unique<Vault<Data, 1024>>( );
+    while ( w->allocate( ).second ) { }
+    {
+        std::vector<std::jthread> thr;
+        for ( size_t i = 0; i < churners; i++ ) {
+            thr.emplace_back([&w, i] (std::stop_token st) {
+                std::mt19937_64 rng {i};
+                while ( !st.stop_requested( ) )
+                    if ( w->deallocate(rng( ) % 1024) )
+                        w->allocate( );
+            });
+        }
+        for ( size_t n = 0; n < 200000; n++ )
+            ASSERT_TRUE(w->nth_occupied(rng( ) % (1024 - churners))) << n;
+    }
+}
+
+TEST(mt_vault, lock_range)
+{
+    constexpr size_t slots {1024 * 4};
+    constexpr size_t threads {8};
+    constexpr size_t rounds {64};
+
+    auto v = std::make_unique<Vault<Data, slots>>( );
+    for ( size_t n = 0; n < slots; n++ )
+        v->allocate( );
+    v->deallocate(1500);
+
+    std::atomic_bool inside {false};
+    std::jthread     blocked;
+    {
+        auto guard = v->lock_range(1024, 2048);
+        EXPECT_FALSE(guard.occupied(1500));
+        EXPECT_THROW(guard[1500], std::out_of_range);
+        EXPECT_THROW(guard[2048], std::out_of_range);
+        size_t n {0};
+        guard.for_each([&n] (size_t, Data& d) {
+            d.field_3 = "range";
+            n++;
+        });
+        EXPECT_EQ(n, 1023);
+
+        // point operations outside the locked blocks go on, inside they wait for the guard
+        std::jthread {[&v] { v->view(100)( ).field_1 = 1; }}.join( );
+        blocked = std::jthread {[&v, &inside] {
+            v->view(1100)( ).field_1 = 2;
+            inside = true;
+        }};
+        std::this_thread::sleep_for(20ms);
+        EXPECT_FALSE(inside.load( ));
+    }
+    blocked.join( );
+    EXPECT_TRUE(inside.load( ));
+    EXPECT_EQ(v->view(1100)( ).field_3, "range");
+
+    // range rewrites and point updates of the same elements never lose an increment
+    v->lock_range(0, slots).for_each([] (size_t, Data& d) { d.field_1 = 0; });
+    std::atomic_size_t                pointUpdates {0};
+    std::array<std::jthread, threads> thr;
+    for ( size_t i = 0; i < threads; i++ ) {
+        thr[i] = std::jthread([i, &v, &pointUpdates] ( ) {
+            std::mt19937_64 rng {i};
+            for ( size_t r = 0; r < rounds; r++ ) {
+                if ( i == 0 ) {
+                    v->lock_range(512, 3000).for_each([] (size_t, Data& d) { d.field_1 += 1000; });
+                    continue;
+                }
+                for ( size_t n = 0; n < 64; n++ ) {
+                    if ( auto view = v->view(512 + rng( ) % (3000 - 512)) ) {
+                        view( ).field_1++;
+                        pointUpdates++;
+                    }
+                }
+            }
+        });
+    }
+    for ( auto& t: thr )
+        t.join( );
+    size_t sum {0};
+    v->lock_range(512, 3000).for_each([&sum] (size_t, Data& d) { sum += static_cast<size_t>(d.field_1); });
+    EXPECT_EQ(sum, (3000 - 512 - 1) * rounds * 1000 + pointUpdates.load( ));
+}
+
+TEST(mt_vault, intention_locks)
+{
+    constexpr size_t slots {1024 * 4};
+    constexpr size_t rounds {32};
+
+    auto v = std::make_unique<Vault<Data, slots>>( );
+    for ( size_t n = 0; n < slots; n++ )
+        v->allocate( );
+
+    // shared range locks admit each other and point reads, writers of the same blocks wait
+    std::atomic_bool inside {false};
+    std::jthread     blocked;
+    {
+        auto guard = v->lock_range_shared(0, 1024);
+        EXPECT_EQ(guard[10].field_1, 0);
+        std::jthread {[&v] {
+            size_t n {0};
+            v->lock_range_shared(512, 1536).for_each([&n] (size_t, const Data&) { n++; });
+            EXPECT_EQ(n, 1024);
+            EXPECT_TRUE(v->read(100, [] (const Data& d) { EXPECT_EQ(d.field_1, 0); }));
+            v->view(2000)( ).field_1 = 1;
+        }}.join( );
+        blocked = std::jthread {[&v, &inside] {
+            v->view(100)( ).field_1 = 2;
+            inside = true;
+        }};
+        std::this_thread::sleep_for(20ms);
+        EXPECT_FALSE(inside.load( ));
+    }
+    blocked.join( );
+    EXPECT_TRUE(inside.load( ));
+
+    // the vault level locks cover every block
+    inside = false;
+    {
+        auto guard = v->lock_all( );
+        EXPECT_EQ(guard.end_index( ), slots);
+        blocked = std::jthread {[&v, &inside] {
+            v->read(4000, [] (const Data&) { });
+            inside = true;
+        }};
+        std::this_thread::sleep_for(20ms);
+        EXPECT_FALSE(inside.load( ));
+    }
+    blocked.join( );
+    EXPECT_TRUE(inside.load( ));
+
+    // whole vault rewrites, shared snapshots and point updates elsewhere: snapshots never see a half done rewrite
+    v->lock_all( ).for_each([] (size_t, Data& d) { d.field_1 = 0; });
+    std::atomic_size_t          pointUpdates {0};
+    std::array<std::jthread, 4> thr;
+    thr[0] = std::jthread {[&v] {
+        for ( size_t r = 0; r < rounds; r++ )
+            v->lock_all( ).for_each([] (size_t idx, Data& d) {
+                if ( idx < 2048 )
+                    d.field_1++;
+            });
+    }};
+    thr[1] = std::jthread {[&v] {
+        for ( size_t r = 0; r < rounds; r++ ) {
+            std::vector<int> snapshot;
+            v->lock_range_shared(0, 2048).for_each([&snapshot] (size_t, const Data& d) { snapshot.push_back(d.field_1); });
+            EXPECT_EQ(std::ranges::count(snapshot, snapshot.front( )), 2048);
+        }
+    }};
+    for ( size_t i = 2; i < thr.size( ); i++ ) {
+        thr[i] = std::jthread {[i, &v, &pointUpdates] {
+            std::mt19937_64 rng {i};
+            for ( size_t n = 0; n < rounds * 64; n++ ) {
+                if ( auto view = v->view(2048 + rng( ) % 2048) ) {
+                    view( ).field_1++;
+                    pointUpdates++;
+                }
+            }
+        }};
+    }
+    for ( auto& t: thr )
+        t.join( );
+    size_t sum {0};
+    v->lock_all_shared( ).for_each([&sum] (size_t, const Data& d) { sum += static_cast<size_t>(d.field_1); });
+    EXPECT_EQ(sum, 2048 * rounds + pointUpdates.load( ));
+}
+
+TEST(mt_vault, map)
+{
+    constexpr size_t slots {1024 * 4};
+    constexpr size_t threads {8};
+
+    auto m = std::make_unique<VaultMap<std::string, int, slots>>( );
+    EXPECT_TRUE(m->insert("one", 1));
+    EXPECT_FALSE(m->insert("one", 2));
+    EXPECT_EQ(m->find("one")( ), 1);
+    EXPECT_EQ(m->find("one").key( ), "one");
+    EXPECT_FALSE(m->find("two"));
+    EXPECT_TRUE(m->upsert("one", 3));
+    EXPECT_TRUE(m->upsert("two", 4));
+    EXPECT_EQ(m->find("one")( ), 3);
+    EXPECT_EQ(m->find("two")( ), 4);
+    EXPECT_TRUE(m->erase("one"));
+    EXPECT_FALSE(m->erase("one"));
+    EXPECT_FALSE(m->contains("one"));
+    EXPECT_TRUE(m->contains("two"));
+
+    // churn through many more keys than buckets, tombstones get purged and nothing is lost
+    for ( size_t n = 0; n < slots * 8; n++ ) {
+        ASSERT_TRUE(m->insert(fmt::format("churn_{}", n), static_cast<int>(n)));
+        if ( n >= 16 ) {
+            ASSERT_TRUE(m->erase(fmt::format("churn_{}", n - 16)));
+        }
+    }
+    for ( size_t n = slots * 8 - 16; n < slots * 8; n++ )
+        EXPECT_EQ(m->find(fmt::format("churn_{}", n))( ), static_cast<int>(n));
+    EXPECT_TRUE(m->contains("two"));
+    EXPECT_EQ(m->stats( ).occupied, 17);
+
+    // concurrent inserts of the same keys succeed exactly once per key, concurrent upserts lose no increment
+    auto c = std::make_unique<VaultMap<int, int, slots>>( );
+    std::atomic_size_t                inserted {0};
+    std::array<std::jthread, threads> thr;
+    for ( size_t i = 0; i < threads; i++ ) {
+        thr[i] = std::jthread([i, &c, &inserted] ( ) {
+            for ( int k = 0; k < static_cast<int>(slots / 2); k++ )
+                if ( c->insert(k, static_cast<int>(i)) )
+                    inserted++;
+            for ( int k = 0; k < 256; k++ ) {
+                if ( auto v = c->find(k) )
+                    v( ) += 1000;
+                c->upsert(static_cast<int>(slots / 2) + k, 1);
+            }
+        });
+    }
+    for ( auto& t: thr )
+        t.join( );
+    EXPECT_EQ(inserted.load( ), slots / 2);
+    EXPECT_EQ(c->stats( ).occupied, slots / 2 + 256);
+    EXPECT_GE(c->find(0)( ), 1000 * static_cast<int>(threads));
+    // a full map refuses inserts of new keys, upserts of present ones still work
+    size_t more {0};
+    while ( c->insert(-1 - static_cast<int>(more), 0) )
+        more++;
+    EXPECT_EQ(more, slots / 2 - 256);
+    EXPECT_FALSE(c->upsert(-1 - static_cast<int>(more), 0));
+    EXPECT_TRUE(c->upsert(0, 0));
+}
+
+TEST(mt_vault, expected)
+{
+    auto v = std::make_unique<Vault<Data, 64>>( );
+    {
+        auto [view, inserted] = v->allocate( );
+        view( ).field_1       = 7;
+    }
+
+    static_assert(noexcept(v->try_view(0)) && noexcept(v->try_deallocate(0)));
+    auto view = v->try_view(0);
+    ASSERT_TRUE(view.has_value( ));
+    EXPECT_EQ((*view)->field_1, 7);
+    (**view).field_3 = "seven";
+    EXPECT_EQ(v->try_view(1).error( ), vault_errc::not_in_use);
+    EXPECT_EQ(v->try_view(64).error( ), vault_errc::out_of_range);
+    view = std::unexpected {vault_errc::not_in_use};  // releases the lock
+
+    EXPECT_EQ(v->get(0)->field_3, "seven");
+    EXPECT_EQ(v->get(1).error( ), vault_errc::not_in_use);
+    EXPECT_TRUE(v->try_deallocate(0).has_value( ));
+    EXPECT_EQ(v->try_deallocate(0).error( ), vault_errc::not_in_use);
+    EXPECT_EQ(v->try_deallocate(100).error( ), vault_errc::out_of_range);
+    EXPECT_EQ(v->stats( ).occupied, 0);
+}
+
+// short lived threads churning through a cached vault, never two of them holding the same slot
+template<FreeCache SCOPE>
+void cached_churn ( )
+{
+    constexpr size_t slots {1024 * 4};
+    constexpr size_t threads {64};
+
+    auto v = std::make_unique<CachedVault<Data, slots, SCOPE>>( );
+    for ( size_t n = 0; n < slots / 2; n++ )
+        ASSERT_TRUE(v->allocate( ).second);
+
+    std::array<std::atomic_bool, slots> held { };
+    for ( size_t round = 0; round < 4; round++ ) {
+        std::vector<std::jthread> thr;
+        for ( size_t i = 0; i < threads; i++ ) {
+            thr.emplace_back([&v, &held] {
+                for ( size_t n = 0; n < 64; n++ ) {
+                    size_t idx;
+                    {
+                        auto [view, inserted] = v->allocate( );
+                        ASSERT_TRUE(inserted);
+                        idx = view.index( );
+                        ASSERT_FALSE(held[idx].exchange(true));
+                    }
+                    held[idx] = false;
+                    ASSERT_TRUE(v->deallocate(idx));
+                }
+            });
+        }
+    }
+    EXPECT_EQ(v->stats( ).occupied, slots / 2);
+
+    // a thread gets back what it gave back (per CPU only while it is not migrated), and the vault still fills up
+    if constexpr ( SCOPE == FreeCache::per_thread ) {
+        auto [view, inserted] = v->allocate( );
+        const size_t idx      = view.index( );
+        view                  = v->allocate( ).first;
+        EXPECT_TRUE(v->deallocate(idx));
+        EXPECT_EQ(v->allocate( ).first.index( ), idx);
+    }
+    while ( v->allocate( ).second ) { }
+    EXPECT_EQ(v->stats( ).occupied, slots);
+}
+
+TEST(mt_vault, cached)
+{
+    cached_churn<FreeCache::per_cpu>( );
+    cached_churn<FreeCache::per_thread>( );
+}
+
+TEST(mt_vault, deferred_deallocation)
+{
+    auto v = std::make_unique<Vault<Data, 64>>( );
+    for ( size_t n = 0; n < 3; n++ )
+        v->allocate( );
+
+    // a reader keeps slot 0, the expiry thread does not wait for it
+    {
+        auto view = v->view(0);
+        std::jthread {[&v] { EXPECT_TRUE(v->deallocate_deferred(0)); }}.join( );
+        EXPECT_TRUE(view);
+        EXPECT_EQ(v->stats( ).occupied, 3);
+    }
+    EXPECT_FALSE(v->view(0));
+    EXPECT_EQ(v->stats( ).occupied, 2);
+
+    // the holder itself, a moved view and an uncontended slot
+    {
+        auto view = v->view(1);
+        EXPECT_TRUE(v->deallocate_deferred(1));
+        auto other = std::move(view);
+        EXPECT_TRUE(other);
+        other = v->view(2);
+        EXPECT_FALSE(v->view(1));
+    }
+    EXPECT_TRUE(v->deallocate_deferred(2));
+    EXPECT_FALSE(v->deallocate_deferred(2));
+    EXPECT_EQ(v->stats( ).occupied, 0);
+
+    // read() holds the element like a view, and frees it when done
+    const size_t idx = v->allocate( ).first.index( );
+    EXPECT_TRUE(v->read(idx, [&v, idx] (const Data&) { std::jthread {[&v, idx] { EXPECT_TRUE(v->deallocate_deferred(idx)); }}.join( ); }));
+    EXPECT_FALSE(v->occupied(idx));
+    EXPECT_EQ(v->stats( ).occupied, 0);
+
+    // readers, allocators and deferred deallocators racing; every allocation is freed exactly once
+    {
+        std::vector<std::jthread> thr;
+        for ( size_t i = 0; i < 4; i++ ) {
+            thr.emplace_back([&v, i] {
+                for ( size_t n = 0; n < 1000; n++ ) {
+                    if ( i % 2 ) {
+                        if ( auto view = v->view(n % 8) )
+                            view( ).field_1++;
+                    } else if ( i == 0 ) {
+                        v->allocate( );
+                    } else {
+                        v->deallocate_deferred(n % 8);
+                    }
+                }
+            });
+        }
+    }
+    for ( size_t n = 0; n < 64; n++ )
+        v->deallocate_deferred(n);
+    const auto s = v->stats( );
+    EXPECT_EQ(s.occupied, 0);
+    EXPECT_EQ(s.allocations, s.deallocations);
+
+    // a deferred deallocation racing the allocation of its slot: once it has seen the slot in use it frees it
+    for ( size_t n = 0; n < 64; n++ )
+        v->allocate( );
+    v->deallocate(0);
+    for ( size_t round = 0; round < 2000; round++ ) {
+        {
+            std::jthread expiry {[&v] {
+                while ( !v->deallocate_deferred(0) )
+                    std::this_thread::yield( );
+            }};
+            EXPECT_EQ(v->allocate( ).first.index( ), 0);
+        }
+        ASSERT_FALSE(v->occupied(0)) << "round " << round;
+    }
+}
+
+TEST(mt_vault, reservation)
+{
+    constexpr size_t slots {256};
+
+    auto v = std::make_unique<Vault<Data, slots>>( );
+    for ( size_t n = 0; n < slots - 8; n++ )
+        v->allocate( );
+
+    {
+        auto r = v->reserve(5);
+        ASSERT_TRUE(r);
+        EXPECT_FALSE(v->reserve(4));
+        EXPECT_EQ(v->stats( ).reserved, 5);
+        EXPECT_EQ(v->stats( ).occupied, slots - 8);
+
+        // others get what is not reserved, the reservation still gets all of its slots
+        EXPECT_TRUE(v->allocate( ).second);
+        EXPECT_TRUE(v->allocate( ).second);
+        EXPECT_TRUE(v->allocate( ).second);
+        EXPECT_FALSE(v->allocate( ).second);
+        for ( size_t n = 0; n < 4; n++ )
+            EXPECT_TRUE(v->allocate(r).second);
+        EXPECT_EQ(r.remaining( ), 1);
+    }
+    // the unused unit went back
+    EXPECT_EQ(v->stats( ).reserved, 0);
+    EXPECT_EQ(v->stats( ).occupied, slots - 1);
+    EXPECT_TRUE(v->allocate( ).second);
+    EXPECT_FALSE(v->allocate( ).second);
+
+    // concurrent reservations never overcommit, and every granted unit finds its slot
+    for ( size_t n = 0; n < slots; n++ )
+        v->deallocate(n);
+    std::atomic_size_t granted {0};
+    {
+        std::vector<std::jthread> thr;
+        for ( size_t i = 0; i < 8; i++ ) {
+            thr.emplace_back([&v, &granted, i] {
+                for ( size_t n = 0; n < 200; n++ ) {
+                    if ( i % 2 ) {
+                        if ( auto [view, inserted] = v->allocate( ); inserted )
+                            v->deallocate(view);
+                        continue;
+                    }
+                    auto r = v->reserve(1 + n % 7);
+                    if ( !r )
+                        continue;
+                    granted += r.remaining( );
+                    std::vector<size_t> taken;
+                    while ( r.remaining( ) ) {
+                        auto [view, inserted] = v->allocate(r);
+                        ASSERT_TRUE(inserted);
+                        taken.push_back(view.index( ));
+                    }
+                    for ( const size_t idx: taken )
+                        v->deallocate(idx);
+                }
+            });
+        }
+    }
+    EXPECT_GT(granted, 0);
+    EXPECT_EQ(v->stats( ).occupied, 0);
+    EXPECT_EQ(v->stats( ).reserved, 0);
+}
+
+TEST(mt_vault, watermarks)
+{
+    constexpr size_t slots {64};
+
+    auto                                      v = std::make_unique<Vault<Data, slots>>( );
+    std::vector<std::pair<Watermark, size_t>> events;
+    EXPECT_THROW(v->set_watermarks(50, 40), std::invalid_argument);
+    v->set_watermarks(40, 50, [&events] (Watermark w, size_t n) { events.emplace_back(w, n); });
+    const int fd = v->watermark_fd( );
+    ASSERT_GE(fd, 0);
+
+    for ( size_t n = 0; n < 49; n++ )
+        v->allocate( );
+    EXPECT_TRUE(events.empty( ));
+    v->allocate( );
+    ASSERT_EQ(events.size( ), 1);
+    EXPECT_EQ(events.back( ), std::make_pair(Watermark::high, size_t {50}));
+    EXPECT_TRUE(v->above_high_watermark( ));
+
+    // hysteresis: going back and forth between the marks stays quiet
+    for ( size_t n = 0; n < 10; n++ )
+        v->deallocate(n);
+    v->allocate( );
+    v->deallocate(0);
+    EXPECT_EQ(events.size( ), 1);
+    v->deallocate(10);
+    ASSERT_EQ(events.size( ), 2);
+    EXPECT_EQ(events.back( ), std::make_pair(Watermark::low, size_t {39}));
+    EXPECT_FALSE(v->above_high_watermark( ));
+
+    // a reservation counts as occupancy
+    {
+        auto r = v->reserve(11);
+        EXPECT_EQ(events.back( ).first, Watermark::high);
+    }
+    EXPECT_EQ(events.back( ).first, Watermark::low);
+
+    uint64_t crossings {0};
+    ASSERT_EQ(::read(fd, &crossings, sizeof(crossings)), sizeof(crossings));
+    EXPECT_EQ(crossings, 4);
+    EXPECT_EQ(events.size( ), 4);
+
+    v->set_watermarks(0, SIZE_MAX);
+    while ( v->allocate( ).second ) { }
+    EXPECT_EQ(events.size( ), 4);
+}
+
+TEST(mt_vault, tenants)
+{
+    constexpr size_t slots {1024};
+
+    auto v = std::make_unique<TenantVault<Data, slots, 4>>( );
+    EXPECT_THROW(v->set_quota(0, 10, 5), std::invalid_argument);
+    v->set_quota(0, 50, 100);
+    v->set_partition(1, 512, 768);
+
+    // the hard quota is exact, the soft one counts what goes beyond it
+    std::vector<size_t> taken;
+    for ( auto [view, inserted] = v->allocate(0); inserted; std::tie(view, inserted) = v->allocate(0) ) {
+        EXPECT_EQ(v->tenant_of(view), 0);
+        taken.push_back(view.index( ));
+    }
+    auto s = v->tenant_stats(0);
+    EXPECT_EQ(taken.size( ), 100);
+    EXPECT_EQ(s.used, 100);
+    EXPECT_EQ(s.overSoft, 50);
+    EXPECT_EQ(s.refusals, 1);
+    EXPECT_TRUE(v->deallocate(taken.back( )));
+    EXPECT_TRUE(v->allocate(0).second);
+
+    // partitioned tenants start in their partition and spill over once it is full
+    for ( size_t n = 0; n < 256; n++ ) {
+        auto [view, inserted] = v->allocate(1);
+        ASSERT_TRUE(inserted);
+        EXPECT_GE(view.index( ), 512);
+        EXPECT_LT(view.index( ), 768);
+    }
+    auto [view, inserted] = v->allocate(1);
+    EXPECT_TRUE(inserted);
+    EXPECT_EQ(v->tenant_stats(1).partitionMisses, 1);
+    view = v->view(0);
+
+    // an unaligned partition past the spilled slot 100: nothing below first, and the last free slot of the partition is found past taken ones
+    v->set_partition(3, 300, 400);
+    for ( size_t n = 0; n < 100; n++ ) {
+        auto [view, inserted] = v->allocate(3);
+        ASSERT_TRUE(inserted);
+        EXPECT_GE(view.index( ), 300);
+        EXPECT_LT(view.index( ), 400);
+    }
+    EXPECT_EQ(v->tenant_stats(3).partitionMisses, 0);
+    EXPECT_TRUE(v->deallocate(387));
+    EXPECT_EQ(v->allocate(3).first.index( ), 387);
+    EXPECT_EQ(v->tenant_stats(3).partitionMisses, 0);
+    EXPECT_TRUE(v->allocate(3).second);
+    EXPECT_EQ(v->tenant_stats(3).partitionMisses, 1);
+
+    auto empty = std::make_unique<TenantVault<Data, 256, 2>>( );
+    empty->set_partition(0, 100, 200);
+    EXPECT_EQ(empty->allocate(0).first.index( ), 100);
+    EXPECT_EQ(empty->tenant_stats(0).partitionMisses, 0);
+
+    // many threads of one tenant never exceed its quota together, and give everything back
+    v->set_quota(2, 64, 128);
+    std::atomic_size_t peak {0};
+    std::atomic_size_t held {0};
+    {
+        std::vector<std::jthread> thr;
+        for ( size_t i = 0; i < 16; i++ ) {
+            thr.emplace_back([&v, &peak, &held] {
+                for ( size_t n = 0; n < 500; n++ ) {
+                    size_t idx;
+                    {
+                        auto [view, inserted] = v->allocate(2);
+                        if ( !inserted )
+                            continue;
+                        idx            = view.index( );
+                        const size_t h = ++held;
+                        for ( size_t p = peak.load( ); h > p && !peak.compare_exchange_weak(p, h); ) { }
+                    }
+                    held--;
+                    v->deallocate(idx);
+                }
+            });
+        }
+    }
+    EXPECT_LE(peak, 128);
+    EXPECT_EQ(v->tenant_stats(2).used, 0);
+    EXPECT_EQ(v->tenant_stats(2).allocations, 16 * 500 - v->tenant_stats(2).refusals);
+}
+
+TEST(mt_vault, headroom)
+{
+    constexpr size_t slots {100};
+
+    auto v = std::make_unique<Vault<Data, slots>>( );
+    EXPECT_THROW(v->set_headroom(slots + 1), std::invalid_argument);
+    v->set_headroom_percent(10);
+    EXPECT_EQ(v->headroom( ), 10);
+
+    // normal traffic stops short of the headroom, high priority gets the rest
+    size_t normal {0};
+    while ( v->allocate( ).second )
+        normal++;
+    EXPECT_EQ(normal, slots - 10);
+    EXPECT_FALSE(v->reserve(1));
+    EXPECT_FALSE(v->allocate_at(slots - 1).second);
+    auto r = v->reserve(2, Priority::high);
+    EXPECT_TRUE(r);
+    EXPECT_TRUE(v->allocate_at(slots - 1, Priority::high).second);
+    size_t high {0};
+    while ( v->allocate(Priority::high).second )
+        high++;
+    EXPECT_EQ(high, 7);
+    EXPECT_TRUE(v->allocate(r).second);
+
+    // freed slots go to normal traffic again only once the headroom is back
+    v->deallocate(0);
+    EXPECT_FALSE(v->allocate( ).second);
+    v->set_headroom(0);
+    EXPECT_TRUE(v->allocate( ).second);
+}
+
+TEST(mt_vault, find_free)
+{
+    auto v = std::make_unique<Vault<Data, 256>>( );
+
+    // from inside a word: the slots before it come last, after wrapping around
+    std::array<size_t, 256> found;
+    ASSERT_EQ(v->find_free(10, found), 256);
+    EXPECT_EQ(found[0], 10);
+    EXPECT_EQ(found[245], 255);
+    EXPECT_EQ(found[246], 0);
+    EXPECT_EQ(found[255], 9);
+    EXPECT_EQ(std::set<size_t>(found.begin( ), found.end( )).size( ), 256);
+
+    for ( size_t n = 0; n < 200; n++ )
+        v->allocate( );
+    std::array<size_t, 4> few;
+    ASSERT_EQ(v->find_free(130, few), 4);
+    EXPECT_EQ(few[0], 200);
+    ASSERT_EQ(v->find_free(300, few), 4);  // from wraps at capacity
+    EXPECT_EQ(few[0], 200);
+}
+
+TEST(mt_vault, cached_refused)
+{
+    // a slot refused by admission stays in the cache, and is handed out again once there is room
+    auto v = std::make_unique<CachedVault<Data, 256, FreeCache::per_thread>>( );
+    size_t idx;
+    {
+        auto [view, inserted] = v->allocate( );
+        idx                   = view.index( );
+    }
+    EXPECT_TRUE(v->deallocate(idx));
+    v->base( ).set_headroom(256);
+    EXPECT_FALSE(v->allocate( ).second);
+    EXPECT_FALSE(v->base( ).occupied(idx));
+    v->base( ).set_headroom(0);
+    EXPECT_EQ(v->allocate( ).first.index( ), idx);
+}
+
+TEST(mt_vault, lock_range_nested)
+{
+    // a thread nesting range locks takes a block that another locker already holds while it waits for the outer guard;
+    // that locker has to back off instead of waiting for it
+    auto v = std::make_unique<Vault<Data, 2048>>( );
+
+    std::atomic_bool locked {false};
+    std::jthread     other;
+    {
+        auto outer = v->lock_range(512, 1024);
+        other      = std::jthread {[&v, &locked] {
+            auto guard = v->lock_range(0, 1024);
+            locked     = true;
+        }};
+        std::this_thread::sleep_for(20ms);
+        auto inner = v->lock_range(0, 512);
+        EXPECT_FALSE(locked.load( ));
+    }
+    other.join( );
+    EXPECT_TRUE(locked.load( ));
+}
@@ -1,16 +1,90 @@
+#pragma once
+
 #include <fmt/format.h>
 #include <fmt/ostream.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <expected>
+#include <functional>
+#include <memory>
 #include <mutex>
-#include <atomic>
+#include <numeric>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "my_vault_trace.h"
 
 #define LOCK_FREE 1
 
 using namespace std::chrono_literals;
 
-template<class ElementData, size_t COUNT = 1024>
+// Event counter split over cache-line sized cells, so that hot paths of many threads do not fight for the same line.
+// Reading sums all cells: the result is not a snapshot, but it is lock free and monotonic for a monotonic counter.
+class VaultCounter
+{
+    static constexpr size_t CELLS = 16;
+
+    struct alignas(64) Cell {
+        std::atomic_size_t value {0};
+    };
+
+    std::array<Cell, CELLS> cells;
+
+    static size_t cell ( )
+    {
+        thread_local const size_t idx = std::hash<std::thread::id> { }(std::this_thread::get_id( )) % CELLS;
+        return idx;
+    }
+
+public:
+    void add (size_t n = 1) { cells[cell( )].value.fetch_add(n, std::memory_order_relaxed); }
+
+    [[nodiscard]] size_t load ( ) const
+    {
+        size_t sum {0};
+        for ( const auto& c: cells )
+            sum += c.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+};
+
+// errors of the exception free API: try_view(), get() and try_deallocate()
+enum class vault_errc {
+    out_of_range,  // index beyond the capacity
+    not_in_use,    // the slot is free
+};
+
+// occupancy mark crossed, see Vault::set_watermarks()
+enum class Watermark {
+    high,  // reached the high mark
+    low,   // dropped below the low mark
+};
+
+// allocation classes, see Vault::set_headroom()
+enum class Priority {
+    normal,
+    high,  // may take the headroom
+};
+
+// TAGS user defined tags per slot, kept as bitmaps next to the occupancy bitmap (see for_each_tagged())
+template<class ElementData, size_t COUNT = 1024, size_t TAGS = 0>
 class Vault
 {
     struct Element {
@@ -21,26 +95,161 @@ class Vault
 #else
         bool inUse {false};
 #endif
+        // deallocate_deferred() names the allocation it frees by its generation, a slot reused meanwhile is left alone
+        std::atomic_uint32_t generation {0};   // allocations of the slot so far, wrapping before UINT32_MAX, changed under access before inUse
+        std::atomic_uint32_t pendingFree {0};  // generation + 1 of the allocation to free, 0 for none
     };
 
     std::array<Element, COUNT> storage;
 #if !LOCK_FREE
-    std::mutex access;
+    // recursive: a view dropped under it may have to complete a deferred deallocation (see settle())
+    std::recursive_mutex access;
 #endif
+
+    // one bit per slot, changed together with inUse under the element lock; scans use them to skip whole words
+    static constexpr size_t WORDS = (COUNT + 63) / 64;
+    using Bitmap                  = std::array<std::atomic<uint64_t>, WORDS>;
+
+    Bitmap                   occupancy { };
+    std::array<Bitmap, TAGS> tagBits { };
+
+    static constexpr uint64_t bit (size_t idx) { return uint64_t {1} << (idx % 64); }
+
+    // Multi-granularity locking, vault -> block of LOCK_BLOCK slots -> element, in the modes IS, IX, S and X. Point
+    // operations take an intention on the vault and on their block before the element mutex: IX when they may change the
+    // element, IS when they only read it. Range locks take S or X on whole blocks under an IS or IX on the vault, and
+    // lock_all() takes S or X on the vault itself. Compatible pairs: IS with IS, IX and S; IX with IS and IX; S with IS
+    // and S; X with nothing.
+    // A block word counts IX and IS holders in its low bits and S holders above them, X_LOCKED marks the exclusive holder.
+    // Vault intentions are counted in per thread stripes with the same layout, so point operations do not share a cache
+    // line; vaultLock holds the S count and X_LOCKED of the vault level lockers, which drain all stripes.
+    static constexpr size_t   LOCK_BLOCK   = 512;
+    static constexpr size_t   LOCK_BLOCKS  = (COUNT + LOCK_BLOCK - 1) / LOCK_BLOCK;
+    static constexpr size_t   LOCK_STRIPES = 16;
+    static constexpr uint64_t IX_ONE       = 1;
+    static constexpr uint64_t IS_ONE       = uint64_t {1} << 24;
+    static constexpr uint64_t S_ONE        = uint64_t {1} << 48;
+    static constexpr uint64_t X_LOCKED     = uint64_t {1} << 63;
+    static constexpr uint64_t IX_MASK      = IS_ONE - 1;
+    static constexpr uint64_t IS_MASK      = S_ONE - IS_ONE;
+    static constexpr uint64_t S_MASK       = X_LOCKED - S_ONE;
+
+    struct alignas(64) LockWord {
+        std::atomic_uint64_t state {0};
+    };
+
+    std::array<LockWord, LOCK_BLOCKS>  blockLocks;
+    std::array<LockWord, LOCK_STRIPES> vaultStripes;
+    alignas(64) std::atomic_uint64_t   vaultLock {0};
+
+    // IS or IX held on a vault stripe and, for point operations, on a block
+    class Intention
+    {
+        std::atomic_uint64_t* stripe {nullptr};
+        std::atomic_uint64_t* block {nullptr};
+        uint64_t              unit {0};
+
+    public:
+        Intention( ) = default;
+
+        Intention(std::atomic_uint64_t* s, std::atomic_uint64_t* b, uint64_t u) : stripe {s}, block {b}, unit {u} { }
+
+        Intention(Intention&& o) noexcept : stripe {std::exchange(o.stripe, nullptr)}, block {std::exchange(o.block, nullptr)}, unit {o.unit} { }
+
+        Intention& operator= (Intention&& o) noexcept
+        {
+            if ( this != &o ) {
+                leave( );
+                stripe = std::exchange(o.stripe, nullptr);
+                block  = std::exchange(o.block, nullptr);
+                unit   = o.unit;
+            }
+            return *this;
+        }
+
+        ~Intention( ) { leave( ); }
+
+        explicit operator bool ( ) const { return stripe != nullptr; }
+
+        void leave ( )
+        {
+            if ( block )
+                std::exchange(block, nullptr)->fetch_sub(unit, std::memory_order_release);
+            if ( stripe )
+                std::exchange(stripe, nullptr)->fetch_sub(unit, std::memory_order_release);
+        }
+    };
+
+public:
+    // lock waits are bucketed by power of two nanoseconds: bucket i counts waits shorter than 2^i ns, the last one is +Inf
+    static constexpr size_t LOCK_WAIT_BUCKETS = 32;
+
+    struct Stats {
+        size_t                                capacity {0};
+        size_t                                occupied {0};
+        size_t                                reserved {0};  // units held by reservations, see reserve()
+        size_t                                allocations {0};
+        size_t                                allocationFailures {0};
+        size_t                                deallocations {0};
+        size_t                                deallocationMisses {0};
+        size_t                                views {0};
+        size_t                                casRetries {0};
+        size_t                                scannedSlots {0};  // slots examined by allocate() looking for a free one
+        std::array<size_t, LOCK_WAIT_BUCKETS> lockWaits { };
+        size_t                                lockWaitNs {0};
+        size_t                                memoryBytes {0};
+    };
+
 public:
     struct iterator;
 
     class ElementView
     {
+        Intention                    intention;  // released after the element lock
         std::unique_lock<std::mutex> lock;
         Element*                     ref {nullptr};
+        size_t                       idx {COUNT};
+        Vault*                       owner {nullptr};
 
-        ElementView( ) = default;
+        ElementView(Intention n, std::unique_lock<std::mutex> l, Element& e, size_t i, Vault& o) :
+            intention {std::move(n)}, lock {std::move(l)}, ref {&e}, idx {i}, owner {&o}
+        { }
 
-        explicit ElementView(Element& e) : lock {e.access}, ref {&e} { }
         friend class Vault;
 
+        // lets go of the element, then completes a deallocate_deferred() that came in meanwhile; the fence pairs with
+        // the one there: either it sees the element unlocked, or this sees the pending free
+        void drop ( )
+        {
+            if ( !lock.owns_lock( ) )
+                return;
+            lock.unlock( );
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if ( ref->pendingFree.load(std::memory_order_relaxed) != 0 )
+                owner->settle(*ref);
+        }
+
     public:
+        // empty, like the views of failed allocations; front ends refusing an allocation themselves hand out these
+        ElementView( ) = default;
+
+        ElementView(ElementView&&) noexcept = default;
+
+        ElementView& operator= (ElementView&& o) noexcept
+        {
+            if ( this != &o ) {
+                drop( );
+                intention = std::move(o.intention);
+                lock      = std::move(o.lock);
+                ref       = std::exchange(o.ref, nullptr);
+                idx       = std::exchange(o.idx, COUNT);
+                owner     = std::exchange(o.owner, nullptr);
+            }
+            return *this;
+        }
+
+        ~ElementView( ) { drop( ); }
+
         ElementData& operator( ) ( )
         {
             if ( !ref->inUse )
@@ -55,80 +264,1155 @@ public:
             return ref->data;
         }
 
+        // unchecked access for views known to be occupied, like those from try_view(); operator() checks and throws
+        ElementData& operator* ( ) noexcept { return ref->data; }
+
+        const ElementData& operator* ( ) const noexcept { return ref->data; }
+
+        ElementData* operator-> ( ) noexcept { return &ref->data; }
+
+        const ElementData* operator-> ( ) const noexcept { return &ref->data; }
+
         operator bool ( ) const { return ref && ref->inUse; }
+
+        // slot index of the viewed element, capacity() for an empty view
+        [[nodiscard]] size_t index ( ) const { return idx; }
+
+        // tags of the viewed element; a freed slot loses all of them
+        void tag (size_t t, bool on = true)
+        {
+            if ( !*this )
+                throw std::out_of_range {"no such data"};
+            auto& word = owner->tagBits.at(t)[idx / 64];
+            if ( on )
+                word.fetch_or(bit(idx), std::memory_order_relaxed);
+            else
+                word.fetch_and(~bit(idx), std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] bool tagged (size_t t) const { return *this && (owner->tagBits.at(t)[idx / 64].load(std::memory_order_relaxed) & bit(idx)); }
+    };
+
+    // Access to every occupied element of [begin, end), see lock_range(), lock_range_shared() and lock_all(). Elements
+    // are reached without their own locks: no writer can enter the locked blocks, so nothing is allocated or freed in
+    // them either. The shared flavour hands out const data only, and may be held by several threads at once.
+    template<bool EXCLUSIVE>
+    class BasicRangeLock
+    {
+        using Data = std::conditional_t<EXCLUSIVE, ElementData, const ElementData>;
+
+        Vault*    owner {nullptr};
+        size_t    first {0};
+        size_t    last {0};
+        bool      whole {false};  // locked on the vault level, no block is held
+        Intention intention;      // on the vault, left after the blocks
+
+        BasicRangeLock(Vault& o, size_t b, size_t e, bool w, Intention n) : owner {&o}, first {b}, last {e}, whole {w}, intention {std::move(n)} { }
+
+        friend class Vault;
+
+    public:
+        BasicRangeLock(BasicRangeLock&& o) noexcept :
+            owner {std::exchange(o.owner, nullptr)}, first {o.first}, last {o.last}, whole {o.whole}, intention {std::move(o.intention)}
+        { }
+
+        BasicRangeLock& operator= (BasicRangeLock&&) = delete;
+
+        ~BasicRangeLock( )
+        {
+            if ( !owner )
+                return;
+            if ( whole )
+                owner->unlockVault(EXCLUSIVE);
+            else
+                owner->unlockBlocks(first / LOCK_BLOCK, (last + LOCK_BLOCK - 1) / LOCK_BLOCK, EXCLUSIVE);
+        }
+
+        [[nodiscard]] size_t begin_index ( ) const { return first; }
+
+        [[nodiscard]] size_t end_index ( ) const { return last; }
+
+        [[nodiscard]] bool occupied (size_t idx) const { return idx >= first && idx < last && (owner->occupancy[idx / 64].load(std::memory_order_relaxed) & bit(idx)); }
+
+        Data& operator[] (size_t idx)
+        {
+            if ( !occupied(idx) )
+                throw std::out_of_range {"no such data in locked range"};
+            return owner->storage[idx].data;
+        }
+
+        // fn(index, data) for every occupied element of the range, in index order
+        void for_each (const std::function<void(size_t, Data&)>& fn)
+        {
+            for ( size_t w = first / 64; w < (last + 63) / 64; w++ ) {
+                uint64_t bits = owner->occupancy[w].load(std::memory_order_relaxed);
+                for ( ; bits != 0; bits &= bits - 1 ) {
+                    const size_t idx = w * 64 + static_cast<size_t>(std::countr_zero(bits));
+                    if ( idx >= first && idx < last )
+                        fn(idx, owner->storage[idx].data);
+                }
+            }
+        }
     };
 
-    ElementView view (size_t idx) { return ElementView {storage.at(idx)}; }
+    using RangeLock       = BasicRangeLock<true>;
+    using SharedRangeLock = BasicRangeLock<false>;
 
-    std::pair<ElementView, bool> allocate ( )
+    // Capacity set aside by reserve(), taken by allocate(reservation) one slot at a time; what is left goes back when the
+    // reservation is destroyed or released.
+    class Reservation
+    {
+        Vault* owner {nullptr};
+        size_t units {0};
+
+        Reservation( ) = default;
+
+        Reservation(Vault& o, size_t k) : owner {&o}, units {k} { }
+
+        friend class Vault;
+
+    public:
+        Reservation(Reservation&& o) noexcept : owner {std::exchange(o.owner, nullptr)}, units {std::exchange(o.units, 0)} { }
+
+        Reservation& operator= (Reservation&& o) noexcept
+        {
+            if ( this != &o ) {
+                release( );
+                owner = std::exchange(o.owner, nullptr);
+                units = std::exchange(o.units, 0);
+            }
+            return *this;
+        }
+
+        ~Reservation( ) { release( ); }
+
+        // false when reserve() could not grant it
+        operator bool ( ) const { return owner != nullptr; }
+
+        // allocations it still guarantees
+        [[nodiscard]] size_t remaining ( ) const { return units; }
+
+        void release ( )
+        {
+            if ( owner && units != 0 )
+                owner->unreserve(std::exchange(units, 0));
+        }
+    };
+
+private:
+    struct Metrics {
+        alignas(64) std::atomic_size_t occupied {0};  // plus admitted allocations in flight and reserved units, see admit()
+        std::atomic_size_t             reserved {0};
+        std::atomic_size_t             highMark {SIZE_MAX};  // see set_watermarks()
+        std::atomic_size_t             lowMark {0};
+        std::atomic_size_t             headroom {0};  // see set_headroom()
+        VaultCounter                   allocations;
+        VaultCounter                   allocationFailures;
+        VaultCounter                   deallocations;
+        VaultCounter                   deallocationMisses;
+        VaultCounter                   views;
+        VaultCounter                   casRetries;
+        VaultCounter                   scannedSlots;
+        // only touched when a lock was contended, so plain atomics are fine here
+        std::array<std::atomic_size_t, LOCK_WAIT_BUCKETS> lockWaits { };
+        std::atomic_size_t                                lockWaitNs {0};
+    };
+
+    Metrics metrics;
+
+    // watermark state, touched only when a mark is crossed or set
+    std::mutex                             watermarks;
+    bool                                   aboveHigh {false};
+    int                                    watermarkFd {-1};
+    std::function<void(Watermark, size_t)> onWatermark;
+
+    std::atomic_bool                            tracing {false};
+    std::atomic<std::shared_ptr<TraceRecorder>> recorder;
+
+    // consume_wait() sleeps on produced, allocations only bump it while somebody is waiting
+    std::atomic_size_t consumers {0};
+    std::atomic_size_t produced {0};
+
+    // Helper threads of find_first(), started by the first search that wants them and kept for the following ones; a
+    // round runs fn(1..n) on them while the caller runs fn(0), and ends when all of them are done.
+    class SearchPool
+    {
+        std::mutex                         m;
+        std::condition_variable_any        wake;
+        std::condition_variable            done;
+        const std::function<void(size_t)>* task {nullptr};
+        size_t                             round {0};
+        size_t                             helpers {0};  // taking part in the current round
+        size_t                             running {0};
+        std::vector<std::jthread>          workers;  // stopped and joined first
+
+        void work (std::stop_token st, size_t w)
+        {
+            size_t           seen {0};
+            std::unique_lock l {m};
+            while ( wake.wait(l, st, [this, &seen] { return round != seen; }) ) {
+                seen = round;
+                if ( w > helpers )
+                    continue;
+                l.unlock( );
+                (*task)(w);
+                l.lock( );
+                if ( --running == 0 )
+                    done.notify_one( );
+            }
+        }
+
+    public:
+        std::mutex busy;  // one search at a time on the pool, see find_first()
+
+        // fn must not throw
+        void run (size_t n, const std::function<void(size_t)>& fn)
+        {
+            {
+                std::unique_lock _ {m};
+                while ( workers.size( ) < n )
+                    workers.emplace_back([this, w = workers.size( ) + 1] (std::stop_token st) { work(st, w); });
+                task    = &fn;
+                helpers = n;
+                running = n;
+                round++;
+            }
+            wake.notify_all( );
+            fn(0);
+            std::unique_lock l {m};
+            done.wait(l, [this] { return running == 0; });
+        }
+    };
+
+    SearchPool searchPool;
+
+    // rank directory for nth_occupied() and sample(): occupied slots before every block of the occupancy bitmap, rebuilt
+    // by the first rank query after the vault changed, so allocation and deallocation pay nothing for it
+    static constexpr size_t RANK_BLOCK_WORDS = 8;
+    static constexpr size_t RANK_BLOCKS      = (WORDS + RANK_BLOCK_WORDS - 1) / RANK_BLOCK_WORDS;
+
+    struct RankDirectory {
+        size_t              version {0};
+        std::vector<size_t> before;  // RANK_BLOCKS + 1 entries, the last one is the total
+    };
+
+    std::atomic<std::shared_ptr<const RankDirectory>> rankDirectory;
+    std::mutex                                        rankRebuild;
+
+    std::unique_lock<std::mutex> lockElement (Element& e)
+    {
+        std::unique_lock l {e.access, std::try_to_lock};
+        if ( !l.owns_lock( ) ) {
+            const auto start = std::chrono::steady_clock::now( );
+            l.lock( );
+            const auto ns     = static_cast<size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now( ) - start).count( ));
+            const auto bucket = std::min<size_t>(std::bit_width(ns), LOCK_WAIT_BUCKETS - 1);
+            metrics.lockWaits[bucket].fetch_add(1, std::memory_order_relaxed);
+            metrics.lockWaitNs.fetch_add(ns, std::memory_order_relaxed);
+        }
+        return l;
+    }
+
+    ElementView acquire (Element& e)
+    {
+        const auto idx = static_cast<size_t>(&e - storage.data( ));
+        Intention  n {intend(idx, IX_ONE)};
+        return ElementView {std::move(n), lockElement(e), e, idx, *this};
+    }
+
+    std::atomic_uint64_t& stripe ( )
+    {
+        thread_local const size_t s = std::hash<std::thread::id> { }(std::this_thread::get_id( )) % LOCK_STRIPES;
+        return vaultStripes[s].state;
+    }
+
+    // vault level S and X keep IX out, only X keeps IS out; on a block the same, with S counted instead of flagged
+    static constexpr uint64_t vaultConflicts (uint64_t unit) { return unit == IX_ONE ? ~uint64_t {0} : X_LOCKED; }
+
+    static constexpr uint64_t blockConflicts (uint64_t unit) { return unit == IX_ONE ? X_LOCKED | S_MASK : X_LOCKED; }
+
+    // Raises the stripe before reading vaultLock, vault lockers set vaultLock before reading the stripes: with sequential
+    // consistency on both sides one of them always sees the other.
+    std::atomic_uint64_t& enterVault (uint64_t unit)
+    {
+        auto& s = stripe( );
+        for ( ;; ) {
+            s.fetch_add(unit);
+            uint64_t v = vaultLock.load( );
+            if ( !(v & vaultConflicts(unit)) )
+                return s;
+            s.fetch_sub(unit);
+            for ( ; v & vaultConflicts(unit); v = vaultLock.load( ) )
+                vaultLock.wait(v);
+        }
+    }
+
+    // IS or IX on the vault and on the block of idx, waiting while either is locked in a conflicting mode
+    Intention intend (size_t idx, uint64_t unit)
+    {
+        auto& s = enterVault(unit);
+        auto& b = blockLocks[idx / LOCK_BLOCK].state;
+        for ( uint64_t v = b.fetch_add(unit, std::memory_order_acquire); v & blockConflicts(unit); v = b.fetch_add(unit, std::memory_order_acquire) ) {
+            b.fetch_sub(unit, std::memory_order_relaxed);
+            for ( v = b.load( ); v & blockConflicts(unit); v = b.load( ) )
+                b.wait(v);
+        }
+        return Intention {&s, &b, unit};
+    }
+
+    // empty intention instead of waiting
+    Intention tryIntend (size_t idx, uint64_t unit)
+    {
+        auto& s = stripe( );
+        s.fetch_add(unit);
+        if ( vaultLock.load( ) & vaultConflicts(unit) ) {
+            s.fetch_sub(unit);
+            return Intention { };
+        }
+        auto& b = blockLocks[idx / LOCK_BLOCK].state;
+        if ( b.fetch_add(unit, std::memory_order_acquire) & blockConflicts(unit) ) {
+            b.fetch_sub(unit, std::memory_order_relaxed);
+            s.fetch_sub(unit);
+            return Intention { };
+        }
+        return Intention {&s, &b, unit};
+    }
+
+    // Threads may wait for a lock while holding intentions elsewhere (a view kept across another call), so lockers wait
+    // for conflicting intentions to drain only for a while; on timeout they give up and the caller backs off.
+    static bool drain (const std::atomic_uint64_t& word, uint64_t mask)
+    {
+        constexpr size_t DRAIN_SPINS = 1024;
+
+        for ( size_t spin = 0; word.load( ) & mask; spin++ ) {
+            if ( spin == DRAIN_SPINS )
+                return false;
+            std::this_thread::yield( );
+        }
+        return true;
+    }
+
+    // vault level S or X; range lockers hold an intention on the vault, so they are drained like point operations
+    bool lockVault (bool exclusive)
+    {
+        for ( uint64_t v = vaultLock.load( );; ) {
+            if ( exclusive ? v == 0 : !(v & X_LOCKED) ) {
+                if ( vaultLock.compare_exchange_weak(v, exclusive ? X_LOCKED : v + S_ONE) )
+                    break;
+                continue;
+            }
+            vaultLock.wait(v);
+            v = vaultLock.load( );
+        }
+        for ( auto& s: vaultStripes ) {
+            if ( !drain(s.state, exclusive ? IX_MASK | IS_MASK : IX_MASK) ) {
+                unlockVault(exclusive);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void unlockVault (bool exclusive)
+    {
+        if ( exclusive )
+            vaultLock.fetch_and(~X_LOCKED, std::memory_order_release);
+        else
+            vaultLock.fetch_sub(S_ONE, std::memory_order_release);
+        vaultLock.notify_all( );
+    }
+
+    // Block S or X. Exclusive lockers exclude each other with X_LOCKED, shared lockers only back off from it; then the
+    // conflicting point operations have to drain. Waiting for another X_LOCKED is bounded like draining: its holder may
+    // be this very thread (nested range locks) or wait for a view this thread keeps, so on timeout the caller backs off.
+    bool lockBlock (size_t b, bool exclusive)
+    {
+        auto& s = blockLocks[b].state;
+        if ( exclusive ) {
+            for ( uint64_t v = s.fetch_or(X_LOCKED, std::memory_order_acquire); v & X_LOCKED; v = s.fetch_or(X_LOCKED, std::memory_order_acquire) )
+                if ( !drain(s, X_LOCKED) )
+                    return false;
+        } else {
+            for ( uint64_t v = s.fetch_add(S_ONE, std::memory_order_acquire); v & X_LOCKED; v = s.fetch_add(S_ONE, std::memory_order_acquire) ) {
+                s.fetch_sub(S_ONE, std::memory_order_relaxed);
+                if ( !drain(s, X_LOCKED) )
+                    return false;
+            }
+        }
+        if ( drain(s, exclusive ? ~X_LOCKED : IX_MASK) )
+            return true;
+        unlockBlock(b, exclusive);
+        return false;
+    }
+
+    void unlockBlock (size_t b, bool exclusive)
+    {
+        if ( exclusive )
+            blockLocks[b].state.fetch_and(~X_LOCKED, std::memory_order_release);
+        else
+            blockLocks[b].state.fetch_sub(S_ONE, std::memory_order_release);
+        blockLocks[b].state.notify_all( );
+    }
+
+    void unlockBlocks (size_t first, size_t last, bool exclusive)
+    {
+        while ( last > first )
+            unlockBlock(--last, exclusive);
+    }
+
+    // All or nothing: when some block stays locked or does not drain in time the blocks taken so far and the vault
+    // intention are released again before retrying, so threads holding views elsewhere and vault lockers can go on.
+    template<bool EXCLUSIVE>
+    BasicRangeLock<EXCLUSIVE> lockRange (size_t begin, size_t end)
+    {
+        if ( begin > end || end > COUNT )
+            throw std::out_of_range {"bad range"};
+        const size_t first = begin / LOCK_BLOCK;
+        const size_t last  = (end + LOCK_BLOCK - 1) / LOCK_BLOCK;
+        for ( auto backoff = 1us;; backoff = std::min(backoff * 2, std::chrono::microseconds {1ms}) ) {
+            Intention n {&enterVault(EXCLUSIVE ? IX_ONE : IS_ONE), nullptr, EXCLUSIVE ? IX_ONE : IS_ONE};
+            size_t    b = first;
+            while ( b < last && lockBlock(b, EXCLUSIVE) )
+                b++;
+            if ( b == last )
+                return BasicRangeLock<EXCLUSIVE> {*this, begin, end, false, std::move(n)};
+            unlockBlocks(first, b, EXCLUSIVE);
+            n.leave( );
+            std::this_thread::sleep_for(backoff);
+        }
+    }
+
+    template<bool EXCLUSIVE>
+    BasicRangeLock<EXCLUSIVE> lockAll ( )
+    {
+        for ( auto backoff = 1us; !lockVault(EXCLUSIVE); backoff = std::min(backoff * 2, std::chrono::microseconds {1ms}) )
+            std::this_thread::sleep_for(backoff);
+        return BasicRangeLock<EXCLUSIVE> {*this, 0, COUNT, true, Intention { }};
+    }
+
+    // Sets inUse of the locked, free element e, a new generation first: deallocate_deferred() reads the generation around
+    // inUse, so it must not find the new allocation with the generation of the one before. UINT32_MAX is skipped when
+    // wrapping around, its tag generation + 1 would be 0, no pending free.
+    static void publish (Element& e)
+    {
+        const uint32_t next = e.generation.load(std::memory_order_relaxed) + 1;
+        e.generation.store(next == UINT32_MAX ? 0 : next, std::memory_order_relaxed);
+        e.inUse = true;
+    }
+
+    void occupy (size_t idx)
+    {
+        occupancy[idx / 64].fetch_or(bit(idx), std::memory_order_release);
+    }
+
+    void vacate (size_t idx)
+    {
+        occupancy[idx / 64].fetch_and(~bit(idx), std::memory_order_release);
+        for ( auto& tags: tagBits )
+            if ( tags[idx / 64].load(std::memory_order_relaxed) & bit(idx) )
+                tags[idx / 64].fetch_and(~bit(idx), std::memory_order_relaxed);
+    }
+
+    // every change of the occupancy bitmap is followed by one of these counting up
+    size_t occupancyVersion ( ) const { return metrics.allocations.load( ) + metrics.deallocations.load( ); }
+
+    std::shared_ptr<const RankDirectory> ranks ( )
+    {
+        const size_t version = occupancyVersion( );
+        if ( auto d = rankDirectory.load( ); d && d->version == version )
+            return d;
+        std::unique_lock _ {rankRebuild};
+        if ( auto d = rankDirectory.load( ); d && d->version == version )
+            return d;
+        // bits that changed after version was read make the directory newer than its version, never older
+        auto d     = std::make_shared<RankDirectory>( );
+        d->version = version;
+        d->before.resize(RANK_BLOCKS + 1);
+        size_t sum {0};
+        for ( size_t b = 0; b < RANK_BLOCKS; b++ ) {
+            d->before[b] = sum;
+            for ( size_t w = b * RANK_BLOCK_WORDS; w < std::min(WORDS, (b + 1) * RANK_BLOCK_WORDS); w++ )
+                sum += static_cast<size_t>(std::popcount(occupancy[w].load(std::memory_order_acquire)));
+        }
+        d->before[RANK_BLOCKS] = sum;
+        rankDirectory.store(d);
+        return d;
+    }
+
+    // slot of the occupied element with rank k, COUNT when out of range or when its block changed since the directory
+    size_t select (const RankDirectory& d, size_t k) const
+    {
+        if ( k >= d.before.back( ) )
+            return COUNT;
+        const auto b = static_cast<size_t>(std::ranges::upper_bound(d.before, k) - d.before.begin( )) - 1;
+        size_t     r = k - d.before[b];
+        for ( size_t w = b * RANK_BLOCK_WORDS; w < std::min(WORDS, (b + 1) * RANK_BLOCK_WORDS); w++ ) {
+            uint64_t     bits = occupancy[w].load(std::memory_order_acquire);
+            const size_t n    = static_cast<size_t>(std::popcount(bits));
+            if ( r < n ) {
+                for ( ; r > 0; r-- )
+                    bits &= bits - 1;
+                return w * 64 + static_cast<size_t>(std::countr_zero(bits));
+            }
+            r -= n;
+        }
+        return COUNT;
+    }
+
+    // occupied elements carrying tag, locked one at a time; fn returns false to stop
+    template<class Fn>
+    void visitTagged (size_t tag, Fn&& fn)
+    {
+        const Bitmap& tags = tagBits.at(tag);
+        for ( size_t w = 0; w < WORDS; w++ ) {
+            for ( uint64_t bits = tags[w].load(std::memory_order_relaxed) & occupancy[w].load(std::memory_order_acquire); bits != 0; bits &= bits - 1 ) {
+                ElementView v {acquire(storage[w * 64 + static_cast<size_t>(std::countr_zero(bits))])};
+                if ( v.tagged(tag) && !fn(v) )
+                    return;
+            }
+        }
+    }
+
+    void trace (TraceOp op, size_t idx, bool ok)
+    {
+        if ( !tracing.load(std::memory_order_relaxed) )
+            return;
+        if ( auto r = recorder.load( ) )
+            r->record(op, idx, ok);
+    }
+
+    // Allocations are admitted by raising metrics.occupied before they look for a slot, and reserve() raises it ahead of
+    // time: as long as it stays within COUNT there is a free slot for every admitted allocation and reserved unit. A full
+    // vault refuses allocations here, without a scan, and so does one whose occupancy reached the limit of the priority.
+    bool admit (Priority p)
+    {
+        const size_t limit = this->limit(p);
+        if ( metrics.occupied.load(std::memory_order_relaxed) >= limit )
+            return false;
+        const size_t before = metrics.occupied.fetch_add(1, std::memory_order_relaxed);
+        raised(before, before + 1);
+        if ( before < limit )
+            return true;
+        lower(1);
+        return false;
+    }
+
+    size_t limit (Priority p) const { return p == Priority::high ? COUNT : COUNT - metrics.headroom.load(std::memory_order_relaxed); }
+
+    // Watermark checks follow every change of metrics.occupied: two comparisons against marks on the same cache line,
+    // crossWatermark() only when one was crossed.
+    void raised (size_t before, size_t after)
+    {
+        const size_t high = metrics.highMark.load(std::memory_order_relaxed);
+        if ( before < high && after >= high ) [[unlikely]]
+            crossWatermark( );
+    }
+
+    void lower (size_t k)
+    {
+        const size_t before = metrics.occupied.fetch_sub(k, std::memory_order_relaxed);
+        const size_t low    = metrics.lowMark.load(std::memory_order_relaxed);
+        if ( before >= low && before - k < low ) [[unlikely]]
+            crossWatermark( );
+    }
+
+    // Decides from the current count, not from the crossing that led here, so racing crossings settle on the state of
+    // the latest one, and a mark crossed back and forth in between may go unreported.
+    void crossWatermark ( )
+    {
+        std::unique_lock _ {watermarks};
+        const size_t     n = metrics.occupied.load( );
+        Watermark        crossed;
+        if ( !aboveHigh && n >= metrics.highMark.load(std::memory_order_relaxed) )
+            crossed = Watermark::high;
+        else if ( aboveHigh && n < metrics.lowMark.load(std::memory_order_relaxed) )
+            crossed = Watermark::low;
+        else
+            return;
+        aboveHigh = crossed == Watermark::high;
+        if ( watermarkFd >= 0 ) {
+            const uint64_t one {1};
+            [[maybe_unused]] const auto _1 = ::write(watermarkFd, &one, sizeof(one));
+        }
+        if ( onWatermark )
+            onWatermark(crossed, n);
+    }
+
+    // first free slot for an admitted allocation, locked and in use; a lock free scan can miss the slots freed behind it
+    // while those ahead are taken, but one is there, so it starts over
+    ElementView claim ( )
     {
-        iterator i {*this};
 #if LOCK_FREE
-        do {
-            i.iter = std::ranges::find_if_not(storage, &Element::inUse);
-            if ( i.iter == storage.end( ) ) {
-                // throw std::out_of_range {"no empty element found"};
-                return std::make_pair(ElementView { }, false);
-            }
-            bool        exp {false};
-            ElementView v {*i.iter};
-            if ( i.iter->inUse.compare_exchange_strong(exp, true) )
-                return {std::move(v), true};
-        } while ( true );
+        for ( ;; ) {
+            auto e = std::ranges::find_if_not(storage, &Element::inUse);
+            metrics.scannedSlots.add(static_cast<size_t>(std::distance(storage.begin( ), e)) + (e != storage.end( )));
+            if ( e == storage.end( ) ) {
+                metrics.casRetries.add( );
+                continue;
+            }
+            ElementView v {acquire(*e)};
+            if ( !e->inUse ) {  // stays so, inUse only changes under the element lock
+                publish(*e);
+                occupy(v.idx);
+                onAllocated( );
+                trace(TraceOp::allocate, v.idx, true);
+                return v;
+            }
+            metrics.casRetries.add( );
+        }
 #else
         std::unique_lock _ {access};
-        i.iter = std::ranges::find_if_not(storage, &Element::inUse);
-        if ( i.iter == storage.end( ) ) {
-            // throw std::out_of_range {"no empty element found"};
-            return {ElementView { }, false};
+        auto             e = std::ranges::find_if_not(storage, &Element::inUse);
+        metrics.scannedSlots.add(static_cast<size_t>(std::distance(storage.begin( ), e)) + 1);
+        ElementView v {acquire(*e)};
+        publish(*e);
+        occupy(v.idx);
+        onAllocated( );
+        trace(TraceOp::allocate, v.idx, true);
+        return v;
+#endif
+    }
+
+    void unreserve (size_t k)
+    {
+        metrics.reserved.fetch_sub(k, std::memory_order_relaxed);
+        lower(k);
+    }
+
+    void onAllocated ( )
+    {
+        metrics.allocations.add( );
+        if ( consumers.load( ) != 0 ) {
+            produced.fetch_add(1);
+            produced.notify_all( );
         }
-        ElementView v {*i.iter};
-        i.iter->inUse = true;
-        return {std::move(v), true};
+    }
+
+    bool onDeallocated (bool done)
+    {
+        if ( done ) {
+            lower(1);
+            metrics.deallocations.add( );
+        } else {
+            metrics.deallocationMisses.add( );
+        }
+        return done;
+    }
+
+    // with the element locked nobody else can free it, so inUse stays set until we clear it
+    bool consume (ElementView& v, const std::function<void(ElementData&)>& fn)
+    {
+        if ( !v )
+            return false;
+        fn(v.ref->data);
+        v.ref->inUse = false;
+        vacate(v.idx);
+        trace(TraceOp::deallocate, v.idx, true);
+        return onDeallocated(true);
+    }
+
+    bool release (ElementView& v, TraceOp op)
+    {
+        if ( !v.ref )
+            return onDeallocated(false);
+#if LOCK_FREE
+        bool       exp {true};
+        const bool done = v.ref->inUse.compare_exchange_strong(exp, false);
+#else
+        // vault lock comes before element locks: let go of the element and take both in order, it may be freed meanwhile
+        v.lock.unlock( );
+        std::unique_lock _ {access};
+        v.lock.lock( );
+        const bool done = std::exchange(v.ref->inUse, false);
 #endif
+        if ( done )
+            vacate(v.idx);
+        trace(op, v.idx, done);
+        return onDeallocated(done);
     }
 
-    bool deallocate (size_t idx)
+    bool deallocateElement (Element& element)
     {
+        const auto idx = static_cast<size_t>(&element - storage.data( ));
 #if LOCK_FREE
-        ElementView e {storage.at(idx)};
+        ElementView e {acquire(element)};
         bool        exp {true};
-        return e.ref->inUse.compare_exchange_strong(exp, false);
+        const bool  done = e.ref->inUse.compare_exchange_strong(exp, false);
 #else
         std::unique_lock _1 {access};
-        ElementView      e {storage.at(idx)};
-        return std::exchange(e.ref->inUse, false);
+        ElementView      e {acquire(element)};
+        const bool       done = std::exchange(e.ref->inUse, false);
+#endif
+        if ( done )
+            vacate(idx);
+        trace(TraceOp::deallocate, idx, done);
+        return onDeallocated(done);
+    }
+
+    // Frees e for deallocate_deferred() if its lock is free right now; otherwise the holder does it when letting go.
+    // Callers hold an intention on the block of e, a view being dropped still has its own.
+    void settle (Element& e)
+    {
+        std::unique_lock l {e.access, std::try_to_lock};
+        if ( !l.owns_lock( ) )
+            return;
+        const uint32_t tag = e.pendingFree.exchange(0);
+        if ( tag == 0 )
+            return;  // somebody else was faster
+        ElementView v {Intention { }, std::move(l), e, static_cast<size_t>(&e - storage.data( )), *this};
+        if ( v && tag == e.generation.load(std::memory_order_relaxed) + 1 )
+            release(v, TraceOp::deallocate);
+    }
+
+public:
+    ~Vault( )
+    {
+        if ( watermarkFd >= 0 )
+            ::close(watermarkFd);
+    }
+
+    ElementView view (size_t idx)
+    {
+        metrics.views.add( );
+        ElementView v {acquire(storage.at(idx))};
+        trace(TraceOp::view, idx, v);
+        return v;
+    }
+
+    std::pair<ElementView, bool> allocate (Priority p = Priority::normal)
+    {
+        if ( !admit(p) ) {
+            // throw std::out_of_range {"no empty element found"};
+            metrics.allocationFailures.add( );
+            trace(TraceOp::allocate, COUNT, false);
+            return {ElementView { }, false};
+        }
+        return {claim( ), true};
+    }
+
+    // Takes one of the slots reserved by reserve(); fails only when the reservation is used up or empty.
+    std::pair<ElementView, bool> allocate (Reservation& r)
+    {
+        if ( r.owner != this || r.units == 0 )
+            return {ElementView { }, false};
+        r.units--;
+        metrics.reserved.fetch_sub(1, std::memory_order_relaxed);
+        return {claim( ), true};
+    }
+
+    // Reserves capacity for k allocations without picking slots, so that k calls of allocate(reservation) succeed no
+    // matter what other threads do meanwhile; an empty reservation when fewer than k slots are left unreserved. Units
+    // not used by the time the reservation is destroyed are given back.
+    Reservation reserve (size_t k, Priority p = Priority::normal)
+    {
+        const size_t limit = this->limit(p);
+        size_t       v     = metrics.occupied.load(std::memory_order_relaxed);
+        do {
+            if ( k > limit - std::min(v, limit) )
+                return Reservation { };
+        } while ( !metrics.occupied.compare_exchange_weak(v, v + k, std::memory_order_relaxed) );
+        raised(v, v + k);
+        metrics.reserved.fetch_add(k, std::memory_order_relaxed);
+        return Reservation {*this, k};
+    }
+
+    // Claims slot idx if it is free, for allocator front ends that keep track of free slots themselves (see
+    // my_vault_percpu.h). A taken slot is no failure of the vault, so it does not count as one.
+    std::pair<ElementView, bool> allocate_at (size_t idx, Priority p = Priority::normal)
+    {
+        Element& e = storage.at(idx);
+        if ( e.inUse || !admit(p) )
+            return {ElementView { }, false};
+#if LOCK_FREE
+        ElementView v {acquire(e)};
+#else
+        std::unique_lock _ {access};
+        ElementView      v {acquire(e)};
 #endif
+        if ( e.inUse ) {
+            lower(1);
+            return {ElementView { }, false};
+        }
+        publish(e);
+        occupy(idx);
+        onAllocated( );
+        trace(TraceOp::allocate, idx, true);
+        return {std::move(v), true};
+    }
+
+    // whether slot idx is allocated right now, from the occupancy bitmap
+    [[nodiscard]] bool occupied (size_t idx) const { return occupancy.at(idx / 64).load(std::memory_order_relaxed) & bit(idx); }
+
+    // Fills out with slots that are free right now, looking from slot from on and wrapping around, and returns how many
+    // it found. A word of the occupancy bitmap per 64 slots; the slots may be taken before the caller gets to them.
+    size_t find_free (size_t from, std::span<size_t> out) const
+    {
+        const size_t   start = from % COUNT;
+        const uint64_t below = bit(start) - 1;  // slots of the first word before start, looked at after wrapping around
+        size_t         found {0};
+        for ( size_t n = 0, w = start / 64; n <= WORDS && found < out.size( ); n++, w = (w + 1) % WORDS ) {
+            uint64_t bits = ~occupancy[w].load(std::memory_order_relaxed);
+            if ( w == WORDS - 1 && COUNT % 64 != 0 )
+                bits &= (uint64_t {1} << (COUNT % 64)) - 1;
+            if ( n == 0 )
+                bits &= ~below;
+            else if ( n == WORDS )
+                bits &= below;
+            for ( ; bits != 0 && found < out.size( ); bits &= bits - 1 )
+                out[found++] = w * 64 + static_cast<size_t>(std::countr_zero(bits));
+        }
+        return found;
+    }
+
+    bool deallocate (size_t idx) { return deallocateElement(storage.at(idx)); }
+
+    // frees the element the view holds; the view stays locked, but is empty from now on
+    bool deallocate (ElementView& v) { return release(v, TraceOp::deallocate); }
+
+    // Like deallocate(idx), but never waits for views of the element: while one is held the slot is only marked, and
+    // the last view to let go of it frees it. True when the element was in use at the call, even if still held; a slot
+    // freed and reused before the mark lands is not touched. The payload stays in place, as with every deallocation.
+    bool deallocate_deferred (size_t idx)
+    {
+        Element&  e = storage.at(idx);
+        Intention n {intend(idx, IX_ONE)};  // waits for range locks only, like every point operation
+        {
+#if !LOCK_FREE
+            std::unique_lock _ {access};
+#endif
+            const uint32_t gen = e.generation.load(std::memory_order_acquire);
+            if ( !e.inUse || e.generation.load(std::memory_order_acquire) != gen ) {
+                trace(TraceOp::deallocate, idx, false);
+                return onDeallocated(false);
+            }
+            e.pendingFree.store(gen + 1);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        settle(e);
+        return true;
+    }
+
+    // Exception free counterparts of view() and deallocate(idx) for paths where a free slot is an ordinary outcome: one
+    // comparison instead of a bounds checked lookup and no throw when the element has gone meanwhile. A view returned by
+    // try_view() is occupied and stays so while held, * and -> reach the data without checking it again.
+    // Only a bad index and a free slot are errors here. Locking an element or writing the trace may still fail with
+    // std::system_error, which nothing in the vault recovers from anyway; being noexcept, these terminate instead.
+    std::expected<ElementView, vault_errc> try_view (size_t idx) noexcept
+    {
+        if ( idx >= COUNT ) [[unlikely]]
+            return std::unexpected {vault_errc::out_of_range};
+        metrics.views.add( );
+        ElementView v {acquire(storage[idx])};
+        trace(TraceOp::view, idx, v);
+        if ( !v )
+            return std::unexpected {vault_errc::not_in_use};
+        return v;
+    }
+
+    // copy of the element, taken under its lock
+    std::expected<ElementData, vault_errc> get (size_t idx) noexcept(std::is_nothrow_copy_constructible_v<ElementData>)
+    {
+        auto v = try_view(idx);
+        if ( !v )
+            return std::unexpected {v.error( )};
+        return **v;
+    }
+
+    std::expected<void, vault_errc> try_deallocate (size_t idx) noexcept
+    {
+        if ( idx >= COUNT ) [[unlikely]]
+            return std::unexpected {vault_errc::out_of_range};
+        if ( !deallocateElement(storage[idx]) )
+            return std::unexpected {vault_errc::not_in_use};
+        return { };
     }
 
     bool deallocate (const std::function<bool(const ElementData&)>& pred)
     {
 #if LOCK_FREE
+        Intention block;  // entered once per block, not per element
         for ( auto& e: storage ) {
-            ElementView v {e};
+            const auto idx = static_cast<size_t>(&e - storage.data( ));
+            if ( idx % LOCK_BLOCK == 0 ) {
+                block.leave( );
+                block = intend(idx, IX_ONE);
+            }
+            ElementView v {Intention { }, lockElement(e), e, idx, *this};
             if ( v && pred(v( )) ) {
                 bool exp {true};
-                if ( e.inUse.compare_exchange_weak(exp, false) )
-                    return true;
+                if ( e.inUse.compare_exchange_weak(exp, false) ) {
+                    vacate(v.idx);
+                    trace(TraceOp::deallocate_pred, v.idx, true);
+                    return onDeallocated(true);
+                }
+                metrics.casRetries.add( );
             }
         }
-        return false;
+        trace(TraceOp::deallocate_pred, COUNT, false);
+        return onDeallocated(false);
 #else
         std::unique_lock _1 {access};
         do {
             auto iter = std::ranges::find_if(storage, [pred] (const Element& e) { return e.inUse && pred(e.data); });
             if ( iter == storage.cend( ) ) {
                 // throw std::out_of_range{"no such element"};
-                return false;
+                trace(TraceOp::deallocate_pred, COUNT, false);
+                return onDeallocated(false);
             }
-            std::unique_lock _2 {iter->access};
+            const size_t idx = static_cast<size_t>(std::distance(storage.begin( ), iter));
+            ElementView  v {acquire(*iter)};  // completes a deallocate_deferred() that came in meanwhile when let go
             if ( !pred(iter->data) )
                 continue;
-            return std::exchange(iter->inUse, false);
+            const bool done = std::exchange(iter->inUse, false);
+            if ( done )
+                vacate(idx);
+            trace(TraceOp::deallocate_pred, idx, done);
+            return onDeallocated(done);
         } while ( true );
 #endif
     }
 
+    // First element satisfying pred, locked, or an empty view; same first-match result as deallocate(pred), but the
+    // range is searched in chunks by up to `threads` threads: the calling one and helpers the vault keeps between searches.
+    // A search finding the helpers busy with another one goes through the range alone. Chunks are handed out in index
+    // order and every match lowers a shared cutoff, so workers drop chunks and elements past the earliest match found so
+    // far. pred runs on the helpers too; the first exception it throws stops the search and is rethrown here.
+    ElementView find_first (const std::function<bool(const ElementData&)>& pred, size_t threads = std::thread::hardware_concurrency( ))
+    {
+        constexpr size_t CHUNK  = 4096;
+        constexpr size_t CHUNKS = (COUNT + CHUNK - 1) / CHUNK;
+
+        std::unique_lock pool {searchPool.busy, std::defer_lock};
+        threads = std::clamp<size_t>(threads, 1, CHUNKS);
+        if ( threads > 1 && !pool.try_lock( ) )
+            threads = 1;
+        std::atomic_size_t       best {COUNT};
+        std::atomic_size_t       next {0};
+        std::atomic_flag         failed;
+        std::exception_ptr       error;
+        std::vector<ElementView> found;
+        for ( size_t w = 0; w < threads; w++ )
+            found.push_back(ElementView { });
+
+        const std::function<void(size_t)> search = [&] (size_t w) {
+            try {
+                for ( size_t c = next.fetch_add(1); c < CHUNKS && c * CHUNK < best.load(std::memory_order_relaxed); c = next.fetch_add(1) ) {
+                    for ( size_t i = c * CHUNK; i < std::min((c + 1) * CHUNK, COUNT) && i < best.load(std::memory_order_relaxed); i++ ) {
+                        if ( !storage[i].inUse )
+                            continue;
+                        ElementView v {acquire(storage[i])};
+                        if ( !v || !pred(v( )) )
+                            continue;
+                        for ( size_t b = best.load( ); i < b && !best.compare_exchange_weak(b, i); ) { }
+                        found[w] = std::move(v);  // the earliest match of this worker, later chunks can not beat it
+                        break;
+                    }
+                }
+            } catch ( ... ) {
+                if ( !failed.test_and_set( ) )
+                    error = std::current_exception( );
+                best.store(0);  // cuts off every worker
+            }
+        };
+        if ( threads > 1 )
+            searchPool.run(threads - 1, search);
+        else
+            search(0);
+        if ( error )
+            std::rethrow_exception(error);
+        for ( auto& v: found )
+            if ( v.idx == best.load( ) )
+                return std::move(v);
+        return ElementView { };
+    }
+
+    // deallocate(pred) on top of find_first()
+    bool deallocate_first (const std::function<bool(const ElementData&)>& pred, size_t threads = std::thread::hardware_concurrency( ))
+    {
+        ElementView v {find_first(pred, threads)};
+        if ( !v ) {
+            trace(TraceOp::deallocate_pred, COUNT, false);
+            return onDeallocated(false);
+        }
+        return release(v, TraceOp::deallocate_pred);
+    }
+
+    // Claims some occupied element, passes its payload to fn, which may move it out, and frees the slot; false when the
+    // vault is empty. Each thread resumes behind the slot it consumed last, starting at a thread specific offset, so that
+    // concurrent consumers spread over the vault instead of crowding the lowest indices. Elements locked by someone else
+    // are passed over and only waited for when nothing else is left. If fn throws, the element stays allocated.
+    bool try_consume (const std::function<void(ElementData&)>& fn)
+    {
+        thread_local size_t cursor = std::hash<std::thread::id> { }(std::this_thread::get_id( ));
+#if !LOCK_FREE
+        std::unique_lock _ {access};
+#endif
+        size_t busy {COUNT};
+        for ( size_t n = 0; n < COUNT; n++ ) {
+            const size_t idx = (cursor + n) % COUNT;
+            Element&     e   = storage[idx];
+            if ( !e.inUse )
+                continue;
+            Intention b {tryIntend(idx, IX_ONE)};
+            if ( !b ) {
+                busy = std::min(busy, idx);
+                continue;
+            }
+            std::unique_lock l {e.access, std::try_to_lock};
+            if ( !l.owns_lock( ) ) {
+                busy = std::min(busy, idx);
+                continue;
+            }
+            ElementView v {std::move(b), std::move(l), e, idx, *this};
+            if ( consume(v, fn) ) {
+                cursor = idx + 1;
+                return true;
+            }
+        }
+        if ( busy == COUNT )
+            return false;
+        ElementView v {acquire(storage[busy])};
+        if ( !consume(v, fn) )
+            return false;
+        cursor = busy + 1;
+        return true;
+    }
+
+    // try_consume() that sleeps until the next allocation while the vault is empty; false once stop is requested
+    bool consume_wait (const std::function<void(ElementData&)>& fn, std::stop_token stop = { })
+    {
+        struct Waiting {
+            std::atomic_size_t& count;
+            explicit Waiting(std::atomic_size_t& c) : count {c} { count.fetch_add(1); }
+            ~Waiting( ) { count.fetch_sub(1); }
+        } waiting {consumers};
+
+        auto wakeUp = [this] {
+            produced.fetch_add(1);
+            produced.notify_all( );
+        };
+        std::stop_callback wake {stop, wakeUp};
+        while ( !stop.stop_requested( ) ) {
+            // an allocation after this load either is seen by try_consume() or changes produced before we sleep on it
+            const size_t seen = produced.load( );
+            if ( try_consume(fn) )
+                return true;
+            produced.wait(seen);
+        }
+        return false;
+    }
+
+    // calls fn for every occupied element carrying tag, each one locked; only set bits of the tag and occupancy bitmaps
+    // are visited, so the cost follows the number of tagged elements rather than the capacity
+    void for_each_tagged (size_t tag, const std::function<void(ElementView&)>& fn)
+    {
+        visitTagged(tag, [&fn] (ElementView& v) {
+            fn(v);
+            return true;
+        });
+    }
+
+    // frees every element carrying tag that satisfies pred (all of them without one), returns how many
+    size_t deallocate_tagged (size_t tag, const std::function<bool(const ElementData&)>& pred = nullptr)
+    {
+        size_t freed {0};
+        visitTagged(tag, [this, &pred, &freed] (ElementView& v) {
+            if ( (!pred || pred(v( ))) && release(v, TraceOp::deallocate_pred) )
+                freed++;
+            return true;
+        });
+        return freed;
+    }
+
+    // Locks every block overlapping [begin, end) exclusively with one acquisition per block, waiting for point
+    // operations inside them to finish and keeping new ones out until the guard is gone. Point operations and range
+    // locks elsewhere in the vault go on meanwhile. The calling thread must not hold any view while locking, nor use
+    // point operations on the locked blocks while holding the guard; it may hold other range locks, but one sharing a
+    // block with the new range keeps it from ever being granted.
+    RangeLock lock_range (size_t begin, size_t end) { return lockRange<true>(begin, end); }
+
+    // Shared lock of the blocks overlapping [begin, end) for bulk readers such as partial snapshots: waits for writing
+    // point operations (view(), allocate(), deallocate()) to leave the blocks and keeps them out, but lets read() and
+    // other shared range locks in.
+    SharedRangeLock lock_range_shared (size_t begin, size_t end) { return lockRange<false>(begin, end); }
+
+    // the whole vault on the vault level, one lock word instead of one per block
+    RangeLock lock_all ( ) { return lockAll<true>( ); }
+
+    SharedRangeLock lock_all_shared ( ) { return lockAll<false>( ); }
+
+    // Point read under an IS intention: unlike view() it runs alongside shared range locks on its block. fn is called
+    // with the element locked, held like a view: a deallocate_deferred() meanwhile is completed when it lets go. False
+    // when the slot is free.
+    bool read (size_t idx, const std::function<void(const ElementData&)>& fn)
+    {
+        metrics.views.add( );
+        Element&    e = storage.at(idx);
+        ElementView v {intend(idx, IS_ONE), lockElement(e), e, idx, *this};
+        const bool  found = v;
+        trace(TraceOp::view, idx, found);
+        if ( found )
+            fn(e.data);
+        return found;
+    }
+
+    // Occupied element number k (0 based, in index order), locked; empty when fewer are occupied. O(log N) on a vault
+    // unchanged since the previous rank query, otherwise the rank directory is rebuilt first, O(N / 64). Under concurrent
+    // updates it starts over until the directory and the slot it picks agree, so an empty view always means that fewer
+    // were occupied at some point during the call, never that the vault changed too fast.
+    ElementView nth_occupied (size_t k)
+    {
+        for ( ;; ) {
+            const auto   d   = ranks( );
+            const size_t idx = select(*d, k);
+            if ( idx == COUNT ) {
+                if ( k >= d->before.back( ) )
+                    return ElementView { };
+                continue;  // its block changed meanwhile
+            }
+            if ( ElementView v {acquire(storage[idx])}; v )
+                return v;
+        }
+    }
+
+    // min(k, occupied) distinct occupied slots, chosen uniformly at random and sorted, O(k log N) past the directory
+    // rebuild; under concurrent updates a slot may be freed again before the caller gets to view it
+    template<class URBG>
+    std::vector<size_t> sample (size_t k, URBG&& rng)
+    {
+        const auto          d = ranks( );
+        const size_t        n = d->before.back( );
+        std::vector<size_t> picked;
+        if ( k >= n ) {
+            picked.resize(n);
+            std::iota(picked.begin( ), picked.end( ), size_t {0});
+        } else {
+            // Floyd's algorithm: k distinct ranks out of n in k steps
+            std::unordered_set<size_t> chosen;
+            for ( size_t j = n - k; j < n; j++ ) {
+                const size_t t = std::uniform_int_distribution<size_t> {0, j}(rng);
+                chosen.insert(chosen.contains(t) ? j : t);
+            }
+            picked.assign(chosen.begin( ), chosen.end( ));
+        }
+        std::vector<size_t> slots;
+        slots.reserve(picked.size( ));
+        for ( size_t r: picked )
+            if ( const size_t idx = select(*d, r); idx != COUNT )
+                slots.push_back(idx);
+        std::ranges::sort(slots);
+        return slots;
+    }
+
+    // occupied elements carrying tag, exact only while no one changes tags or frees slots
+    [[nodiscard]] size_t count_tagged (size_t tag) const
+    {
+        size_t n {0};
+        for ( size_t w = 0; w < WORDS; w++ )
+            n += static_cast<size_t>(std::popcount(tagBits.at(tag)[w].load(std::memory_order_relaxed) & occupancy[w].load(std::memory_order_relaxed)));
+        return n;
+    }
+
     void dump ( ) const
     {
         for ( size_t i = 0; i < COUNT; i++ ) {
@@ -157,7 +1441,7 @@ public:
             return *this;
         }
 
-        value_type operator* ( ) { return ElementView {*iter}; }
+        value_type operator* ( ) { return owner.acquire(*iter); }
 
         bool operator== (const iterator& o) const { return iter == o.iter; }
 
@@ -189,4 +1473,87 @@ public:
     }
 
     [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+
+    // opt-in operation log (see my_vault_trace.h); costs one relaxed load per operation while off
+    bool start_trace (const std::string& path)
+    {
+        auto r = std::make_shared<TraceRecorder>(path, COUNT);
+        if ( !r->good( ) )
+            return false;
+        recorder.store(std::move(r));
+        tracing = true;
+        return true;
+    }
+
+    // the file is complete once operations that were already recording have returned
+    void stop_trace ( )
+    {
+        tracing = false;
+        recorder.store(nullptr);
+    }
+
+    // Keeps the last slots for Priority::high: normal allocations and reservations are refused once occupancy, counted the
+    // way admission does, leaves fewer than that many free. Refusals are ordinary allocation failures.
+    void set_headroom (size_t slots)
+    {
+        if ( slots > COUNT )
+            throw std::invalid_argument {"headroom beyond capacity"};
+        metrics.headroom.store(slots, std::memory_order_relaxed);
+    }
+
+    void set_headroom_percent (size_t percent) { set_headroom(COUNT * std::min<size_t>(percent, 100) / 100); }
+
+    [[nodiscard]] size_t headroom ( ) const { return metrics.headroom.load(std::memory_order_relaxed); }
+
+    // Backpressure signals: Watermark::high once occupancy reaches high, Watermark::low once it drops below low after
+    // that, nothing in between. Occupancy counts reserved units and admitted allocations, the way admission does. fn runs
+    // on the thread whose operation crossed the mark, which may hold an element lock: it must not wait for the vault, nor
+    // change the watermarks. set_watermarks(0, SIZE_MAX) turns them off.
+    void set_watermarks (size_t low, size_t high, std::function<void(Watermark, size_t)> fn = { })
+    {
+        if ( low > high )
+            throw std::invalid_argument {"low watermark above the high one"};
+        std::unique_lock _ {watermarks};
+        onWatermark = std::move(fn);
+        metrics.lowMark.store(low);
+        metrics.highMark.store(high);
+        aboveHigh = metrics.occupied.load( ) >= high;
+    }
+
+    // eventfd counting watermark crossings, for poll loops that read it and ask above_high_watermark() which way it went
+    int watermark_fd ( )
+    {
+        std::unique_lock _ {watermarks};
+        if ( watermarkFd < 0 )
+            watermarkFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return watermarkFd;
+    }
+
+    [[nodiscard]] bool above_high_watermark ( )
+    {
+        std::unique_lock _ {watermarks};
+        return aboveHigh;
+    }
+
+    // lock free snapshot of counters, safe to call concurrently with any other operation
+    [[nodiscard]] Stats stats ( ) const
+    {
+        Stats s;
+        s.capacity           = COUNT;
+        const size_t claimed = metrics.occupied.load(std::memory_order_relaxed);
+        s.reserved           = metrics.reserved.load(std::memory_order_relaxed);
+        s.occupied           = claimed - std::min(claimed, s.reserved);
+        s.allocations        = metrics.allocations.load( );
+        s.allocationFailures = metrics.allocationFailures.load( );
+        s.deallocations      = metrics.deallocations.load( );
+        s.deallocationMisses = metrics.deallocationMisses.load( );
+        s.views              = metrics.views.load( );
+        s.casRetries         = metrics.casRetries.load( );
+        s.scannedSlots       = metrics.scannedSlots.load( );
+        for ( size_t i = 0; i < LOCK_WAIT_BUCKETS; i++ )
+            s.lockWaits[i] = metrics.lockWaits[i].load(std::memory_order_relaxed);
+        s.lockWaitNs  = metrics.lockWaitNs.load(std::memory_order_relaxed);
+        s.memoryBytes = sizeof(*this);
+        return s;
+    }
 };
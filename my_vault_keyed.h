@@ -0,0 +1,222 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "my_vault.h"
+
+// Counting Bloom filter over 64 bit hashes with 8 bit saturating counters. A counter that reached the maximum is never
+// decremented again, so removals can only leave false positives behind, never false negatives.
+template<size_t COUNTERS, size_t HASHES = 4>
+class CountingBloomFilter
+{
+    static_assert(std::has_single_bit(COUNTERS));
+
+    static constexpr uint8_t SATURATED = 0xff;
+
+    std::array<std::atomic<uint8_t>, COUNTERS> counters { };
+
+    // double hashing, the odd step visits HASHES distinct counters
+    static size_t position (uint64_t h, size_t i) { return (h + i * ((h >> 32) | 1)) & (COUNTERS - 1); }
+
+public:
+    void add (uint64_t h)
+    {
+        for ( size_t i = 0; i < HASHES; i++ ) {
+            auto&   c = counters[position(h, i)];
+            uint8_t v = c.load(std::memory_order_relaxed);
+            while ( v != SATURATED && !c.compare_exchange_weak(v, v + 1, std::memory_order_release, std::memory_order_relaxed) ) { }
+        }
+    }
+
+    void remove (uint64_t h)
+    {
+        for ( size_t i = 0; i < HASHES; i++ ) {
+            auto&   c = counters[position(h, i)];
+            uint8_t v = c.load(std::memory_order_relaxed);
+            while ( v != SATURATED && v != 0 && !c.compare_exchange_weak(v, v - 1, std::memory_order_release, std::memory_order_relaxed) ) { }
+        }
+    }
+
+    [[nodiscard]] bool may_contain (uint64_t h) const
+    {
+        for ( size_t i = 0; i < HASHES; i++ )
+            if ( counters[position(h, i)].load(std::memory_order_acquire) == 0 )
+                return false;
+        return true;
+    }
+};
+
+// Vault whose elements carry a key, KeyOf(const ElementData&), guarded by a counting Bloom filter so that lookups and
+// deletions of absent keys return without scanning the vault.
+// The filter follows the element contents: a key is published when the view that set it is released and withdrawn under
+// the element lock before the slot is freed, so a key whose view was released is never reported missing. Keys of
+// elements still held by a view may not be visible yet. Every change has to go through this class, which is why the
+// underlying vault is not exposed.
+template<class ElementData, size_t COUNT, class KeyOf, size_t COUNTERS_PER_SLOT = 8>
+class KeyedVault
+{
+    using Base = Vault<ElementData, COUNT>;
+
+public:
+    using Key = std::remove_cvref_t<std::invoke_result_t<KeyOf, const ElementData&>>;
+
+    struct FilterStats {
+        size_t lookups {0};
+        size_t rejects {0};         // answered by the filter alone
+        size_t falsePositives {0};  // passed the filter, but the scan found nothing
+    };
+
+    class View
+    {
+        typename Base::ElementView view;
+        KeyedVault*                owner {nullptr};
+
+        View(typename Base::ElementView v, KeyedVault& o) : view {std::move(v)}, owner {&o} { }
+
+        friend class KeyedVault;
+
+    public:
+        View(View&& o) noexcept : view {std::move(o.view)}, owner {std::exchange(o.owner, nullptr)} { }
+
+        View& operator= (View&& o) noexcept
+        {
+            if ( this != &o ) {
+                if ( owner )
+                    owner->publish(view);
+                view  = std::move(o.view);
+                owner = std::exchange(o.owner, nullptr);
+            }
+            return *this;
+        }
+
+        ~View( )
+        {
+            if ( owner )
+                owner->publish(view);
+        }
+
+        ElementData& operator( ) ( ) { return view( ); }
+
+        const ElementData& operator( ) ( ) const { return view( ); }
+
+        operator bool ( ) const { return static_cast<bool>(view); }
+
+        [[nodiscard]] size_t index ( ) const { return view.index( ); }
+    };
+
+    explicit KeyedVault(KeyOf k = { }) : keyOf {std::move(k)} { }
+
+    std::pair<View, bool> allocate ( )
+    {
+        auto [v, inserted] = vault.allocate( );
+        return {View {std::move(v), *this}, inserted};
+    }
+
+    View view (size_t idx) { return View {vault.view(idx), *this}; }
+
+    bool deallocate (size_t idx)
+    {
+        auto v = vault.view(idx);
+        if ( v )
+            withdraw(idx);
+        return vault.deallocate(v);
+    }
+
+    [[nodiscard]] bool contains (const Key& key)
+    {
+        return find(key, [] (typename Base::ElementView&) { });
+    }
+
+    // first-match like Vault::deallocate(pred), free of any scan when the filter rules the key out
+    bool deallocate_by_key (const Key& key)
+    {
+        return find(key, [this] (typename Base::ElementView& v) {
+            withdraw(v.index( ));
+            vault.deallocate(v);
+        });
+    }
+
+    [[nodiscard]] FilterStats filter_stats ( ) const
+    {
+        return {.lookups = lookups.load( ), .rejects = rejects.load( ), .falsePositives = falsePositives.load( )};
+    }
+
+    [[nodiscard]] typename Base::Stats stats ( ) const { return vault.stats( ); }
+
+    [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+
+private:
+    struct Published {
+        uint64_t hash {0};
+        bool     valid {false};
+    };
+
+    Base                                                          vault;
+    KeyOf                                                         keyOf;
+    CountingBloomFilter<std::bit_ceil(COUNT * COUNTERS_PER_SLOT)> filter;
+    std::array<Published, COUNT>                                  published { };  // what the filter holds per slot, guarded by the element lock
+    VaultCounter                                                  lookups;
+    VaultCounter                                                  rejects;
+    VaultCounter                                                  falsePositives;
+
+    // std::hash of integers is the identity on common implementations, spread it before it indexes the filter
+    uint64_t hash (const Key& key) const
+    {
+        uint64_t h = std::hash<Key> { }(key);
+        h          = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h          = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    // called with the element lock held; the new key goes in before the old one leaves, so it is never absent in between
+    void publish (typename Base::ElementView& v)
+    {
+        if ( v.index( ) >= COUNT )
+            return;
+        auto& p = published[v.index( )];
+        if ( !v ) {
+            withdraw(v.index( ));
+            return;
+        }
+        const uint64_t h = hash(keyOf(v( )));
+        if ( p.valid && p.hash == h )
+            return;
+        filter.add(h);
+        if ( p.valid )
+            filter.remove(p.hash);
+        p = {h, true};
+    }
+
+    void withdraw (size_t idx)
+    {
+        auto& p = published[idx];
+        if ( p.valid )
+            filter.remove(p.hash);
+        p.valid = false;
+    }
+
+    template<class OnMatch>
+    bool find (const Key& key, OnMatch&& onMatch)
+    {
+        lookups.add( );
+        if ( !filter.may_contain(hash(key)) ) {
+            rejects.add( );
+            return false;
+        }
+        for ( auto i = vault.begin( ); i != vault.end( ); ++i ) {
+            auto v = *i;
+            if ( v && keyOf(v( )) == key ) {
+                onMatch(v);
+                return true;
+            }
+        }
+        falsePositives.add( );
+        return false;
+    }
+};
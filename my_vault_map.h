@@ -0,0 +1,293 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "my_vault.h"
+
+// Concurrent hash map whose entries live in Vault slots, indexed by an open addressing table of atomic words that is
+// probed without locks. insert(), find(), erase() and upsert() lock only the slot of the key they are about to compare
+// or change, never a bucket range or the table.
+// A bucket is EMPTY, a TOMBSTONE left by erase(), or the slot of an entry together with the upper half of its key hash,
+// which rules out most foreign keys without touching their slot. Buckets only go from EMPTY to used and from used to
+// TOMBSTONE, so two inserts of the same key always meet on its probe sequence. Tombstones are purged by rebuilding the
+// table once they take up a quarter of it; operations wait for that, which is the only time they wait for each other
+// outside a slot lock.
+// K and V have to be default constructible, erased entries keep their payload until the slot is reused, like in Vault.
+template<class K, class V, size_t COUNT, class Hash = std::hash<K>>
+class VaultMap
+{
+    struct Entry {
+        K key;
+        V value;
+    };
+
+    using Base = Vault<Entry, COUNT>;
+
+    static constexpr size_t   TABLE     = std::bit_ceil(COUNT * 2);
+    static constexpr uint64_t EMPTY     = 0;
+    static constexpr uint64_t TOMBSTONE = 1;
+    static constexpr size_t   STRIPES   = 16;
+
+    static_assert(COUNT < (uint64_t {1} << 32) - 2, "slot indices have to fit the lower half of a bucket");
+
+public:
+    class View
+    {
+        std::optional<typename Base::ElementView> view;
+
+        View( ) = default;
+
+        explicit View(typename Base::ElementView v) : view {std::move(v)} { }
+
+        friend class VaultMap;
+
+    public:
+        operator bool ( ) const { return view && *view; }
+
+        const K& key ( ) const { return (*view)( ).key; }
+
+        V& operator( ) ( ) { return (*view)( ).value; }
+
+        const V& operator( ) ( ) const { return (*view)( ).value; }
+
+        // slot of the entry in the underlying vault, capacity() for an empty view
+        [[nodiscard]] size_t index ( ) const { return view ? view->index( ) : COUNT; }
+    };
+
+    // false when the key is present already or no slot is left
+    bool insert (const K& key, V value)
+    {
+        for ( ;; ) {
+            const auto r = place(key, value);
+            if ( r != Placed::retry )
+                return r == Placed::inserted;
+            rebuild( );
+        }
+    }
+
+    // the entry of key, locked; empty when absent
+    View find (const K& key)
+    {
+        Guard _ {*this};
+        return lookup(key, hash(key)).first;
+    }
+
+    [[nodiscard]] bool contains (const K& key) { return static_cast<bool>(find(key)); }
+
+    bool erase (const K& key)
+    {
+        const uint64_t h = hash(key);
+        bool           erased {false};
+        {
+            Guard _ {*this};
+            while ( !erased ) {
+                auto [v, p] = lookup(key, h);
+                if ( !v )
+                    break;
+                // under the slot lock: once the bucket is a tombstone no new lookup reaches the slot
+                uint64_t b = bucket(h, v.index( ));
+                if ( table[p].compare_exchange_strong(b, TOMBSTONE, std::memory_order_acq_rel) ) {
+                    vault.deallocate(*v.view);
+                    erasures.add( );
+                    erased = true;
+                }
+            }
+        }
+        if ( erased && erasures.load( ) - purged.load(std::memory_order_relaxed) > TABLE / 4 )
+            rebuild( );
+        return erased;
+    }
+
+    // sets the value of key, inserting it when absent; false only when it had to be inserted and no slot was left
+    bool upsert (const K& key, V value)
+    {
+        for ( ;; ) {
+            if ( auto v = find(key) ) {
+                v( ) = std::move(value);
+                return true;
+            }
+            const auto r = place(key, value);
+            if ( r == Placed::inserted || r == Placed::full )
+                return r == Placed::inserted;
+            if ( r == Placed::retry )
+                rebuild( );
+        }
+    }
+
+    [[nodiscard]] typename Base::Stats stats ( ) const { return vault.stats( ); }
+
+    [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+
+private:
+    enum class Placed { inserted, exists, full, retry };
+
+    struct alignas(64) Stripe {
+        std::atomic_size_t active {0};
+    };
+
+    // operations on the table in progress, counted per thread stripe so that they do not share a cache line; rebuild()
+    // raises rebuilding first and then waits for the stripes to drain
+    class Guard
+    {
+        std::atomic_size_t& active;
+
+    public:
+        explicit Guard(VaultMap& m) : active {m.stripe( )}
+        {
+            for ( ;; ) {
+                active.fetch_add(1);
+                if ( !m.rebuilding.load( ) )
+                    return;
+                active.fetch_sub(1);
+                m.rebuilding.wait(true);
+            }
+        }
+
+        Guard(const Guard&)             = delete;
+        Guard& operator= (const Guard&) = delete;
+
+        ~Guard( ) { active.fetch_sub(1, std::memory_order_release); }
+    };
+
+    Base                                    vault;
+    std::array<std::atomic_uint64_t, TABLE> table { };
+    std::array<std::atomic_uint64_t, COUNT> hashes { };  // full key hash per slot, for rebuild()
+    std::array<Stripe, STRIPES>             stripes;
+    std::atomic_bool                        rebuilding {false};
+    VaultCounter                            erasures;
+    std::atomic_size_t                      purged {0};  // erasures whose tombstones are gone
+    Hash                                    hasher;
+
+    std::atomic_size_t& stripe ( )
+    {
+        thread_local const size_t s = std::hash<std::thread::id> { }(std::this_thread::get_id( )) % STRIPES;
+        return stripes[s].active;
+    }
+
+    // std::hash is the identity for integers on common implementations, both halves of the word have to be mixed here
+    uint64_t hash (const K& key) const
+    {
+        uint64_t h = static_cast<uint64_t>(hasher(key));
+        h          = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+        h          = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        return h ^ (h >> 33);
+    }
+
+    static uint64_t bucket (uint64_t h, size_t slot) { return (h & 0xffffffff00000000ULL) | (slot + 2); }
+
+    static size_t slotOf (uint64_t b) { return static_cast<size_t>(b & 0xffffffffULL) - 2; }
+
+    static bool sameTag (uint64_t b, uint64_t h) { return (b >> 32) == (h >> 32); }
+
+    // the locked entry of key and the bucket it was reached through
+    std::pair<View, size_t> lookup (const K& key, uint64_t h)
+    {
+        for ( size_t i = 0; i < TABLE; i++ ) {
+            const size_t   p = (h + i) & (TABLE - 1);
+            const uint64_t b = table[p].load(std::memory_order_acquire);
+            if ( b == EMPTY )
+                break;
+            if ( b == TOMBSTONE || !sameTag(b, h) )
+                continue;
+            // the slot may have been erased and reused since the bucket was read, the lock makes the comparison stable
+            if ( auto v = vault.view(slotOf(b)); v && v( ).key == key && table[p].load(std::memory_order_acquire) == b )
+                return {View {std::move(v)}, p};
+        }
+        return {View { }, TABLE};
+    }
+
+    // Claims the first EMPTY bucket of the probe sequence, comparing every entry of the same tag on the way. The new
+    // slot gets its key up front but stays unlocked while others are locked for comparison: holding it could deadlock
+    // with a lookup that reached it through a stale bucket. It is locked again only to move the value in and publish.
+    // value is left alone unless inserted; retry asks for a rebuild, the probe sequence had no EMPTY bucket.
+    Placed place (const K& key, V& value)
+    {
+        const uint64_t h = hash(key);
+        size_t         slot {COUNT};
+        auto           drop = [this, &slot] {
+            if ( slot != COUNT )
+                vault.deallocate(slot);
+        };
+
+        Guard _ {*this};
+        for ( size_t i = 0; i < TABLE; ) {
+            const size_t p = (h + i) & (TABLE - 1);
+            uint64_t     b = table[p].load(std::memory_order_acquire);
+            if ( b == EMPTY ) {
+                if ( slot == COUNT ) {
+                    auto [v, inserted] = vault.allocate( );
+                    if ( !inserted )
+                        return Placed::full;
+                    v( ).key = key;
+                    slot     = v.index( );
+                    hashes[slot].store(h, std::memory_order_relaxed);
+                }
+                auto own     = vault.view(slot);
+                own( ).value = std::move(value);
+                if ( table[p].compare_exchange_strong(b, bucket(h, slot), std::memory_order_acq_rel) )
+                    return Placed::inserted;
+                value = std::move(own( ).value);
+                continue;  // somebody else took the bucket, look at what is there now
+            }
+            if ( b != TOMBSTONE && sameTag(b, h) ) {
+                bool exists;
+                {
+                    auto v = vault.view(slotOf(b));
+                    exists = v && v( ).key == key && table[p].load(std::memory_order_acquire) == b;
+                }
+                if ( exists ) {
+                    drop( );
+                    return Placed::exists;
+                }
+            }
+            i++;
+        }
+        drop( );
+        return Placed::retry;
+    }
+
+    // Rehashes the live buckets into a table without tombstones. Skipped when another thread is at it, or when some
+    // operation does not leave in time, because its thread may hold a view of a slot another operation waits for.
+    void rebuild ( )
+    {
+        constexpr size_t DRAIN_SPINS = 1024;
+
+        bool expected {false};
+        if ( !rebuilding.compare_exchange_strong(expected, true) )
+            return;
+        bool drained {true};
+        for ( auto& s: stripes ) {
+            for ( size_t spin = 0; drained && s.active.load( ) != 0; spin++ ) {
+                drained = spin < DRAIN_SPINS;
+                std::this_thread::yield( );
+            }
+        }
+        if ( drained ) {
+            const size_t          erased = erasures.load( );
+            std::vector<uint64_t> live;
+            for ( auto& b: table ) {
+                if ( const uint64_t v = b.load(std::memory_order_acquire); v != EMPTY && v != TOMBSTONE )
+                    live.push_back(v);
+                b.store(EMPTY, std::memory_order_relaxed);
+            }
+            for ( const uint64_t v: live ) {
+                const uint64_t h = hashes[slotOf(v)].load(std::memory_order_relaxed);
+                size_t         p = h & (TABLE - 1);
+                while ( table[p].load(std::memory_order_relaxed) != EMPTY )
+                    p = (p + 1) & (TABLE - 1);
+                table[p].store(v, std::memory_order_relaxed);
+            }
+            purged.store(erased, std::memory_order_relaxed);
+        }
+        rebuilding.store(false);
+        rebuilding.notify_all( );
+    }
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#include "my_vault.h"
+
+// Renders Vault::stats() in Prometheus text exposition format (version 0.0.4).
+// Collection only reads atomics, so it may run on a scrape thread concurrently with any vault operation.
+template<class ElementData, size_t COUNT, size_t TAGS>
+std::string prometheus_text (const Vault<ElementData, COUNT, TAGS>& vault, std::string_view name = "default")
+{
+    using V      = Vault<ElementData, COUNT, TAGS>;
+    const auto s = vault.stats( );
+
+    std::string out;
+    auto        it = std::back_inserter(out);
+
+    auto metric = [&it, name] (std::string_view metric, std::string_view type, std::string_view help, size_t value) {
+        fmt::format_to(it, "# HELP mt_vault_{} {}\n# TYPE mt_vault_{} {}\nmt_vault_{}{{vault=\"{}\"}} {}\n", metric, help, metric, type, metric, name, value);
+    };
+
+    metric("capacity", "gauge", "Number of slots in the vault.", s.capacity);
+    metric("occupied", "gauge", "Number of slots currently in use.", s.occupied);
+    metric("reserved", "gauge", "Slots set aside by reservations and not allocated yet.", s.reserved);
+    metric("allocations_total", "counter", "Successful allocations.", s.allocations);
+    metric("allocation_failures_total", "counter", "Allocations that found no free slot.", s.allocationFailures);
+    metric("deallocations_total", "counter", "Successful deallocations.", s.deallocations);
+    metric("deallocation_misses_total", "counter", "Deallocations that found nothing to free.", s.deallocationMisses);
+    metric("views_total", "counter", "Element views requested by index.", s.views);
+    metric("cas_retries_total", "counter", "Lost compare-and-swap races on slot state.", s.casRetries);
+    metric("allocate_scanned_slots_total", "counter", "Slots examined by allocations searching for a free slot.", s.scannedSlots);
+    metric("memory_bytes", "gauge", "Memory footprint of the vault object, excluding heap owned by payloads.", s.memoryBytes);
+
+    fmt::format_to(it, "# HELP mt_vault_lock_wait_seconds Time spent waiting for contended element locks.\n# TYPE mt_vault_lock_wait_seconds histogram\n");
+    size_t cumulative {0};
+    for ( size_t i = 0; i + 1 < V::LOCK_WAIT_BUCKETS; i++ ) {
+        cumulative += s.lockWaits[i];
+        fmt::format_to(it, "mt_vault_lock_wait_seconds_bucket{{vault=\"{}\",le=\"{}\"}} {}\n", name, static_cast<double>(size_t {1} << i) / 1e9, cumulative);
+    }
+    cumulative += s.lockWaits[V::LOCK_WAIT_BUCKETS - 1];
+    fmt::format_to(it, "mt_vault_lock_wait_seconds_bucket{{vault=\"{}\",le=\"+Inf\"}} {}\n", name, cumulative);
+    fmt::format_to(it, "mt_vault_lock_wait_seconds_sum{{vault=\"{}\"}} {}\n", name, static_cast<double>(s.lockWaitNs) / 1e9);
+    fmt::format_to(it, "mt_vault_lock_wait_seconds_count{{vault=\"{}\"}} {}\n", name, cumulative);
+
+    return out;
+}
+
+// Writes through a temporary file and renames it, so a textfile collector never reads a half written file.
+template<class ElementData, size_t COUNT, size_t TAGS>
+bool write_prometheus (const Vault<ElementData, COUNT, TAGS>& vault, const std::string& path, std::string_view name = "default")
+{
+    const std::string tmp {path + ".tmp"};
+    {
+        std::ofstream f {tmp, std::ios::trunc};
+        if ( !(f << prometheus_text(vault, name)) )
+            return false;
+    }
+    return std::rename(tmp.c_str( ), path.c_str( )) == 0;
+}
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define VAULT_RSEQ 1
+#else
+#define VAULT_RSEQ 0
+#endif
+
+#include "my_vault.h"
+
+// where CachedVault keeps the slots it knows to be free
+enum class FreeCache {
+    per_cpu,     // one cache per CPU, reached through restartable sequences; without them through a try-lock per cache
+    per_thread,  // thread_local, lost with the thread
+};
+
+// Allocator front end for Vault: allocate() takes a slot from a small cache of free slots instead of scanning the vault
+// from the start, deallocate() puts the slot back into it, and an empty cache is refilled from the occupancy bitmap,
+// starting at a region of its own. Cached slots are hints, Vault::allocate_at() claims them, so slots freed or taken
+// around the front end do no harm, and neither do caches of threads that are gone: their slots are still free.
+// The per CPU caches are changed by restartable sequences (rseq, Linux on x86-64 with a glibc that registers them):
+// the kernel aborts a sequence that got preempted, migrated or interrupted before its final store, so plain loads and
+// stores suffice and pushing or popping a slot needs no atomic instruction or fence; claiming the popped slot through
+// Vault::allocate_at() still goes through admission, the intention lock and the element lock. Threads may come and go
+// without warming up caches of their own. Where rseq is missing each CPU cache has a spin flag, and a busy cache is simply passed over.
+template<class ElementData, size_t COUNT = 1024, FreeCache SCOPE = FreeCache::per_cpu, size_t DEPTH = 32>
+class CachedVault
+{
+    using Base = Vault<ElementData, COUNT>;
+
+public:
+    using ElementView = typename Base::ElementView;
+
+    CachedVault( ) : caches(SCOPE == FreeCache::per_cpu ? static_cast<size_t>(std::max(1L, sysconf(_SC_NPROCESSORS_CONF))) : 0) { }
+
+    std::pair<ElementView, bool> allocate ( )
+    {
+        for ( bool refilled {false};; refilled = true ) {
+            for ( size_t slot = pop( ); slot != COUNT; slot = pop( ) ) {
+                if ( auto r = vault.allocate_at(slot); r.second )
+                    return r;
+                if ( !vault.occupied(slot) ) {
+                    // refused by admission, not taken: keep the hint, and let the vault account for the failure
+                    push(slot);
+                    return vault.allocate( );
+                }
+            }
+            if ( refilled )
+                break;
+            refill( );
+        }
+        return vault.allocate( );
+    }
+
+    bool deallocate (size_t idx)
+    {
+        if ( !vault.deallocate(idx) )
+            return false;
+        push(idx);
+        return true;
+    }
+
+    ElementView view (size_t idx) { return vault.view(idx); }
+
+    // everything else; slots freed here do not go to the caches, but are found by their refills
+    Base& base ( ) { return vault; }
+
+    [[nodiscard]] typename Base::Stats stats ( ) const { return vault.stats( ); }
+
+    [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+
+    // whether the per CPU caches run on restartable sequences
+    [[nodiscard]] bool restartable ( ) const { return useRseq; }
+
+private:
+    struct alignas(64) CpuCache {
+        uint64_t                    count {0};
+        std::array<uint64_t, DEPTH> slots { };
+        std::atomic_flag            busy;  // without rseq only
+    };
+
+    struct LocalCache {
+        const CachedVault*        owner {nullptr};
+        size_t                    count {0};
+        std::array<size_t, DEPTH> slots { };
+    };
+
+    Base                  vault;
+    std::vector<CpuCache> caches;
+#if VAULT_RSEQ
+    const bool useRseq {__rseq_size > 0};
+#else
+    const bool useRseq {false};
+#endif
+
+    // one vault at a time per thread, switching to another one drops the hints of the previous
+    LocalCache& local ( )
+    {
+        thread_local LocalCache c;
+        if ( c.owner != this )
+            c = LocalCache {.owner = this};
+        return c;
+    }
+
+    // CPU the thread runs on, caches.size() when unknown
+    size_t cpu ( ) const
+    {
+#if VAULT_RSEQ
+        if ( useRseq )
+            return std::min<size_t>(std::atomic_ref {rseqArea( )->cpu_id}.load(std::memory_order_relaxed), caches.size( ));
+#endif
+        const int c = sched_getcpu( );
+        return c < 0 ? caches.size( ) : std::min(static_cast<size_t>(c), caches.size( ));
+    }
+
+    // slot the empty cache of the calling thread starts looking for free ones, spreading the caches over the vault
+    size_t home ( ) const
+    {
+        if constexpr ( SCOPE == FreeCache::per_thread )
+            return std::hash<std::thread::id> { }(std::this_thread::get_id( )) % COUNT;
+        return cpu( ) * (COUNT / caches.size( ));
+    }
+
+    void refill ( )
+    {
+        std::array<size_t, DEPTH / 2> found;
+        const size_t                  n = vault.find_free(home( ), found);
+        for ( size_t i = 0; i < n; i++ )
+            if ( !push(found[i]) )
+                break;
+    }
+
+    // COUNT when the cache is empty or cannot be used right now
+    size_t pop ( )
+    {
+        if constexpr ( SCOPE == FreeCache::per_thread ) {
+            auto& c = local( );
+            return c.count ? c.slots[--c.count] : COUNT;
+        }
+#if VAULT_RSEQ
+        if ( useRseq ) {
+            for ( ;; ) {
+                const size_t c = cpu( );
+                if ( c == caches.size( ) )
+                    return COUNT;
+                uint64_t slot;
+                switch ( rseqPop(static_cast<uint32_t>(c), caches[c], slot) ) {
+                    case Rseq::done: return slot;
+                    case Rseq::refused: return COUNT;
+                    case Rseq::aborted: continue;
+                }
+            }
+        }
+#endif
+        const size_t c = cpu( );
+        if ( c == caches.size( ) || caches[c].busy.test_and_set(std::memory_order_acquire) )
+            return COUNT;
+        const size_t slot = caches[c].count ? caches[c].slots[--caches[c].count] : COUNT;
+        caches[c].busy.clear(std::memory_order_release);
+        return slot;
+    }
+
+    // false when the cache is full or cannot be used right now
+    bool push (size_t slot)
+    {
+        if constexpr ( SCOPE == FreeCache::per_thread ) {
+            auto& c = local( );
+            if ( c.count == DEPTH )
+                return false;
+            c.slots[c.count++] = slot;
+            return true;
+        }
+#if VAULT_RSEQ
+        if ( useRseq ) {
+            for ( ;; ) {
+                const size_t c = cpu( );
+                if ( c == caches.size( ) )
+                    return false;
+                switch ( rseqPush(static_cast<uint32_t>(c), caches[c], slot) ) {
+                    case Rseq::done: return true;
+                    case Rseq::refused: return false;
+                    case Rseq::aborted: continue;
+                }
+            }
+        }
+#endif
+        const size_t c = cpu( );
+        if ( c == caches.size( ) || caches[c].busy.test_and_set(std::memory_order_acquire) )
+            return false;
+        const bool pushed = caches[c].count < DEPTH;
+        if ( pushed )
+            caches[c].slots[caches[c].count++] = slot;
+        caches[c].busy.clear(std::memory_order_release);
+        return pushed;
+    }
+
+#if VAULT_RSEQ
+    static_assert(RSEQ_SIG == 0x53053053, "the abort handlers below carry the x86 signature glibc registers");
+
+    enum class Rseq { done, refused, aborted };
+
+    static struct rseq* rseqArea ( ) { return reinterpret_cast<struct rseq*>(static_cast<char*>(__builtin_thread_pointer( )) + __rseq_offset); }
+
+    // The critical sections follow the kernel ABI: a struct rseq_cs in section __rseq_cs describes the range from 1 to
+    // 2, its address goes to rseq_cs of the thread, and the abort handler at 4 is preceded by the signature. The cpu
+    // check makes sure the cache belongs to the CPU the thread runs on, the store of count at the end commits.
+    static Rseq rseqPop (uint32_t cpu, CpuCache& c, uint64_t& slot)
+    {
+        struct rseq* rs = rseqArea( );
+        asm goto(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %[cs]\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %[cpuId]\n\t"
+            "jnz 4f\n\t"
+            "movq %[count], %%rcx\n\t"
+            "testq %%rcx, %%rcx\n\t"
+            "jz %l[refused]\n\t"
+            "subq $1, %%rcx\n\t"
+            "movq (%[slots], %%rcx, 8), %%rax\n\t"
+            "movq %%rax, %[slot]\n\t"
+            "movq %%rcx, %[count]\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[aborted]\n\t"
+            ".popsection\n\t"
+            :
+            : [cs] "m"(rs->rseq_cs), [cpuId] "m"(rs->cpu_id), [cpu] "r"(cpu), [count] "m"(c.count), [slots] "r"(c.slots.data( )), [slot] "m"(slot)
+            : "memory", "cc", "rax", "rcx"
+            : refused, aborted);
+        return Rseq::done;
+    refused:
+        return Rseq::refused;
+    aborted:
+        return Rseq::aborted;
+    }
+
+    static Rseq rseqPush (uint32_t cpu, CpuCache& c, uint64_t slot)
+    {
+        struct rseq* rs = rseqArea( );
+        asm goto(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %[cs]\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %[cpuId]\n\t"
+            "jnz 4f\n\t"
+            "movq %[count], %%rcx\n\t"
+            "cmpq %[depth], %%rcx\n\t"
+            "jae %l[refused]\n\t"
+            "movq %[slot], (%[slots], %%rcx, 8)\n\t"
+            "addq $1, %%rcx\n\t"
+            "movq %%rcx, %[count]\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[aborted]\n\t"
+            ".popsection\n\t"
+            :
+            : [cs] "m"(rs->rseq_cs), [cpuId] "m"(rs->cpu_id), [cpu] "r"(cpu), [count] "m"(c.count), [slots] "r"(c.slots.data( )), [slot] "r"(slot), [depth] "i"(DEPTH)
+            : "memory", "cc", "rax", "rcx"
+            : refused, aborted);
+        return Rseq::done;
+    refused:
+        return Rseq::refused;
+    aborted:
+        return Rseq::aborted;
+    }
+#endif
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "my_vault.h"
+
+// Vault shared by up to TENANTS tenants, every allocation made on behalf of one of them.
+// A tenant has a hard quota that its allocations never exceed, and a soft one beyond which they still succeed but are
+// counted. Usage is kept like a per CPU counter: the quota left sits in a central word, and threads take it out in small
+// batches into per thread stripes. An allocation takes one unit from the stripe of its thread, so threads of one tenant
+// meet on the central word once per batch, not per allocation. When the central word runs dry the units parked in the
+// stripes are reclaimed before an allocation is refused, so the hard quota is exact; a refusal can still be spurious
+// while another thread of the tenant is reclaiming at the same moment.
+// A tenant may also get a partition of the index space, [first, last), where its allocations look first, for locality;
+// when the partition is full they go anywhere. The owner of every slot is recorded, deallocate(idx) credits it.
+template<class ElementData, size_t COUNT = 1024, size_t TENANTS = 64, size_t STRIPES = 32>
+class TenantVault
+{
+    using Base = Vault<ElementData, COUNT>;
+
+    static constexpr int64_t BATCH = 8;
+
+    static_assert(TENANTS <= std::numeric_limits<uint16_t>::max( ), "owners are kept in 16 bits per slot");
+
+public:
+    using ElementView = typename Base::ElementView;
+
+    struct TenantStats {
+        size_t used {0};  // not a snapshot, like every counter of the vault
+        size_t softQuota {0};
+        size_t hardQuota {0};
+        size_t allocations {0};
+        size_t overSoft {0};         // allocations made beyond the soft quota
+        size_t refusals {0};         // allocations refused by the hard quota
+        size_t vaultFull {0};        // allocations within quota that found no free slot
+        size_t partitionMisses {0};  // allocations placed outside a full partition
+    };
+
+    TenantVault( )
+    {
+        for ( auto& t: tenants )
+            t.available.store(COUNT, std::memory_order_relaxed);
+    }
+
+    // soft <= hard, both up to COUNT; may be called while the tenant allocates, a lowered hard quota below its usage only
+    // stops further allocations
+    void set_quota (size_t tenant, size_t soft, size_t hard)
+    {
+        if ( soft > hard || hard > COUNT )
+            throw std::invalid_argument {"quota has to be soft <= hard <= capacity"};
+        auto&        t   = tenants.at(tenant);
+        const size_t old = t.hard.exchange(hard);
+        t.soft.store(soft, std::memory_order_relaxed);
+        t.available.fetch_add(static_cast<int64_t>(hard) - static_cast<int64_t>(old));
+    }
+
+    void set_partition (size_t tenant, size_t first, size_t last)
+    {
+        if ( first > last || last > COUNT )
+            throw std::invalid_argument {"partition beyond capacity"};
+        auto& t = tenants.at(tenant);
+        t.first.store(first, std::memory_order_relaxed);
+        t.last.store(last, std::memory_order_relaxed);
+    }
+
+    std::pair<ElementView, bool> allocate (size_t tenant)
+    {
+        auto& t = tenants.at(tenant);
+        if ( !take(t) ) {
+            t.refusals.add( );
+            return {ElementView { }, false};
+        }
+        auto r = place(t);
+        if ( !r.second ) {
+            give(t);
+            t.vaultFull.add( );
+            return r;
+        }
+        owners[r.first.index( )].store(static_cast<uint16_t>(tenant), std::memory_order_relaxed);
+        t.allocations.add( );
+        if ( beyondSoft(t) )
+            t.overSoft.add( );
+        return r;
+    }
+
+    ElementView view (size_t idx) { return vault.view(idx); }
+
+    bool deallocate (size_t idx)
+    {
+        auto v = vault.view(idx);
+        if ( !v )
+            return false;
+        const size_t tenant = owners[idx].load(std::memory_order_relaxed);
+        if ( !vault.deallocate(v) )
+            return false;
+        give(tenants[tenant]);
+        return true;
+    }
+
+    // owner of the element the view holds
+    [[nodiscard]] size_t tenant_of (const ElementView& v) const { return owners.at(v.index( )).load(std::memory_order_relaxed); }
+
+    [[nodiscard]] TenantStats tenant_stats (size_t tenant) const
+    {
+        const auto& t = tenants.at(tenant);
+        TenantStats s;
+        s.hardQuota       = t.hard.load(std::memory_order_relaxed);
+        s.softQuota       = t.soft.load(std::memory_order_relaxed);
+        s.used            = granted(t) - std::min(granted(t), parked(t));
+        s.allocations     = t.allocations.load( );
+        s.overSoft        = t.overSoft.load( );
+        s.refusals        = t.refusals.load( );
+        s.vaultFull       = t.vaultFull.load( );
+        s.partitionMisses = t.partitionMisses.load( );
+        return s;
+    }
+
+    [[nodiscard]] typename Base::Stats stats ( ) const { return vault.stats( ); }
+
+    [[nodiscard]] size_t capacity ( ) const { return COUNT; }
+
+    [[nodiscard]] size_t tenants_count ( ) const { return TENANTS; }
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic_int64_t credit {0};  // units taken from available, not used yet
+    };
+
+    struct Tenant {
+        alignas(64) std::atomic_int64_t available {0};  // hard quota minus usage minus credits, negative after lowering it
+        std::atomic_size_t              hard {COUNT};
+        std::atomic_size_t              soft {COUNT};
+        std::atomic_size_t              first {0};
+        std::atomic_size_t              last {0};  // empty partition, none
+        std::array<Stripe, STRIPES>     stripes;
+        VaultCounter                    allocations;
+        VaultCounter                    overSoft;
+        VaultCounter                    refusals;
+        VaultCounter                    vaultFull;
+        VaultCounter                    partitionMisses;
+    };
+
+    Base                                     vault;
+    std::array<Tenant, TENANTS>              tenants;
+    std::array<std::atomic<uint16_t>, COUNT> owners { };
+
+    static size_t stripe ( )
+    {
+        thread_local const size_t s = std::hash<std::thread::id> { }(std::this_thread::get_id( )) % STRIPES;
+        return s;
+    }
+
+    // usage plus parked credits, read from the central word only
+    static size_t granted (const Tenant& t)
+    {
+        const int64_t left = t.available.load(std::memory_order_relaxed);
+        const auto    hard = static_cast<int64_t>(t.hard.load(std::memory_order_relaxed));
+        return static_cast<size_t>(std::max<int64_t>(hard - left, 0));
+    }
+
+    static size_t parked (const Tenant& t)
+    {
+        size_t sum {0};
+        for ( const auto& s: t.stripes )
+            sum += static_cast<size_t>(s.credit.load(std::memory_order_relaxed));
+        return sum;
+    }
+
+    // the central word alone rules it out while the tenant is well below its soft quota, the stripes are summed near it
+    static bool beyondSoft (const Tenant& t)
+    {
+        const size_t soft = t.soft.load(std::memory_order_relaxed);
+        const size_t g    = granted(t);
+        return g > soft && g - std::min(g, parked(t)) > soft;
+    }
+
+    // one unit of quota for an allocation of the calling thread
+    static bool take (Tenant& t)
+    {
+        auto& credit = t.stripes[stripe( )].credit;
+        for ( int64_t c = credit.load(std::memory_order_relaxed); c > 0; )
+            if ( credit.compare_exchange_weak(c, c - 1, std::memory_order_relaxed) )
+                return true;
+        for ( int64_t a = t.available.load(std::memory_order_relaxed); a > 0; ) {
+            const int64_t batch = std::min(a, BATCH);
+            if ( t.available.compare_exchange_weak(a, a - batch, std::memory_order_relaxed) ) {
+                if ( batch > 1 )
+                    credit.fetch_add(batch - 1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        int64_t reclaimed {0};
+        for ( auto& s: t.stripes )
+            if ( s.credit.load(std::memory_order_relaxed) > 0 )
+                reclaimed += s.credit.exchange(0, std::memory_order_relaxed);
+        if ( reclaimed == 0 )
+            return false;
+        if ( reclaimed > 1 )
+            t.available.fetch_add(reclaimed - 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // a unit back to the stripe; a stripe holding more than two batches returns one to the central word
+    static void give (Tenant& t)
+    {
+        auto&   credit = t.stripes[stripe( )].credit;
+        int64_t c      = credit.fetch_add(1, std::memory_order_relaxed) + 1;
+        while ( c > 2 * BATCH ) {
+            if ( credit.compare_exchange_weak(c, c - BATCH, std::memory_order_relaxed) ) {
+                t.available.fetch_add(BATCH, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    // Walks the free slots of the partition in index order until one is claimed. find_free() wraps around at capacity,
+    // so a hit below where it started, or past last, means the partition has nothing left; only then is it a miss.
+    std::pair<ElementView, bool> place (Tenant& t)
+    {
+        const size_t first = t.first.load(std::memory_order_relaxed);
+        const size_t last  = t.last.load(std::memory_order_relaxed);
+        if ( first < last ) {
+            std::array<size_t, 8> found;
+            for ( size_t from = first; from < last; ) {
+                const size_t n = vault.find_free(from, found);
+                size_t       i = 0;
+                for ( ; i < n && found[i] >= from && found[i] < last; i++ ) {
+                    if ( auto r = vault.allocate_at(found[i]); r.second )
+                        return r;
+                    if ( !vault.occupied(found[i]) )
+                        return vault.allocate( );  // refused by admission, the vault accounts for the failure
+                }
+                if ( i < n || n < found.size( ) )
+                    break;
+                from = found[n - 1] + 1;
+            }
+            t.partitionMisses.add( );
+        }
+        return vault.allocate( );
+    }
+};
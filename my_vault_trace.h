@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compact binary log of vault operations, for replaying captured workloads (see mt_vault.replay.benchmark.cpp).
+// File layout: TraceHeader followed by TraceRecord entries, in the order records were claimed, which is timestamp
+// order per thread but only roughly across threads.
+
+enum class TraceOp : uint8_t { allocate, view, deallocate, deallocate_pred };
+
+struct TraceRecord {
+    // threads are numbered in the order they first record anything in the process; those beyond the 16 bits all get
+    // this id, so records carrying it may come from several threads
+    static constexpr uint16_t SHARED_THREAD = UINT16_MAX;
+
+    uint64_t ns;      // since the recorder was started
+    uint32_t index;   // slot, or capacity when the operation found none
+    uint16_t thread;  // id of the calling thread, see SHARED_THREAD
+    TraceOp  op;
+    uint8_t  ok;
+};
+
+static_assert(sizeof(TraceRecord) == 16);
+
+struct TraceHeader {
+    char     magic[8] {'M', 'T', 'V', 'T', 'R', 'A', 'C', 'E'};
+    uint32_t version {1};
+    uint32_t recordSize {sizeof(TraceRecord)};
+    uint64_t capacity {0};
+};
+
+class TraceRecorder
+{
+public:
+    static constexpr size_t CHUNK = 1 << 16;
+
+    TraceRecorder(const std::string& path, size_t capacity) : file {std::fopen(path.c_str( ), "wb")}, chunk(CHUNK)
+    {
+        TraceHeader h;
+        h.capacity = capacity;
+        if ( file && std::fwrite(&h, sizeof(h), 1, file) != 1 ) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+    TraceRecorder(const TraceRecorder&)            = delete;
+    TraceRecorder& operator= (const TraceRecorder&) = delete;
+
+    ~TraceRecorder( )
+    {
+        if ( !file )
+            return;
+        write(std::min(cursor.load( ), CHUNK));
+        std::fclose(file);
+    }
+
+    [[nodiscard]] bool good ( ) const { return file != nullptr; }
+
+    // lock free until the chunk fills up; then one thread writes it out while the others wait for the fresh one
+    void record (TraceOp op, size_t index, bool ok)
+    {
+        const TraceRecord r {
+            .ns     = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now( ) - start).count( )),
+            .index  = static_cast<uint32_t>(index),
+            .thread = threadId( ),
+            .op     = op,
+            .ok     = ok,
+        };
+        do {
+            if ( const size_t pos = cursor.fetch_add(1); pos < CHUNK ) {
+                chunk[pos] = r;
+                committed.fetch_add(1, std::memory_order_release);
+                return;
+            }
+            flush( );
+        } while ( true );
+    }
+
+private:
+    std::FILE*                                  file;
+    const std::chrono::steady_clock::time_point start {std::chrono::steady_clock::now( )};
+    std::vector<TraceRecord>                    chunk;
+    std::atomic_size_t                          cursor {0};
+    std::atomic_size_t                          committed {0};
+    std::mutex                                  flushing;
+
+    // saturates at SHARED_THREAD instead of wrapping around onto the ids of earlier threads
+    static uint16_t threadId ( )
+    {
+        static std::atomic_size_t   next {0};
+        thread_local const uint16_t id = static_cast<uint16_t>(std::min<size_t>(next.fetch_add(1), TraceRecord::SHARED_THREAD));
+        return id;
+    }
+
+    void write (size_t records)
+    {
+        if ( std::fwrite(chunk.data( ), sizeof(TraceRecord), records, file) != records )
+            std::clearerr(file);
+    }
+
+    void flush ( )
+    {
+        std::unique_lock _ {flushing};
+        if ( cursor.load( ) < CHUNK )
+            return;  // someone else already started a fresh chunk
+        while ( committed.load(std::memory_order_acquire) < CHUNK )
+            std::this_thread::yield( );
+        write(CHUNK);
+        committed.store(0);
+        cursor.store(0);
+    }
+};
+
+// whole trace file, empty when it is missing or not a trace
+inline std::vector<TraceRecord> read_trace (const std::string& path, TraceHeader* header = nullptr)
+{
+    std::vector<TraceRecord> records;
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> f {std::fopen(path.c_str( ), "rb"), &std::fclose};
+    TraceHeader                                        h;
+    const TraceHeader                                  expected;
+    if ( !f || std::fread(&h, sizeof(h), 1, f.get( )) != 1 || std::memcmp(h.magic, expected.magic, sizeof(h.magic)) != 0 || h.recordSize != sizeof(TraceRecord) )
+        return records;
+    for ( TraceRecord r; std::fread(&r, sizeof(r), 1, f.get( )) == 1; )
+        records.push_back(r);
+    if ( header )
+        *header = h;
+    return records;
+}